@@ -0,0 +1,288 @@
+// Headless host benchmark for the Peanut-GB core.
+//
+// Runs a ROM for a fixed number of frames without any display, reports the
+// emulation speed and a hash of every rendered frame so two builds of the core
+// can be checked for identical output. The frames are kept between runs of the
+// core, like on screen, as lines that did not change are not drawn again:
+//
+//   make bench
+//   output/host/gbbench src/flappyboy.gb [frames]
+//
+// Built with -DENABLE_OP_PROFILE=1, it also prints how often each opcode
+// pair was run; make profile-pairs adds these up over several ROMs.
+//
+// Instead of a ROM file, mbc1, mbc3 or mbc5 runs a generated test cartridge
+// of that type, which switches ROM and RAM banks in a loop and reads from
+// them, to compare the cost of banked accesses between cartridge types.
+//
+// Built with -DBENCH_CART_RAM_CALLBACKS=1, cartridge RAM is only accessed
+// through the callbacks rather than mapped into the core, which must not
+// change the hashes; make check-cart-ram compares both on the test carts.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "peanut_gb/peanut_gb.h"
+
+#define DEFAULT_FRAMES 6000
+
+#ifndef BENCH_CART_RAM_CALLBACKS
+#define BENCH_CART_RAM_CALLBACKS 0
+#endif
+
+struct priv_t {
+  uint8_t *rom;
+  size_t rom_size;
+  uint8_t *cart_ram;
+  uint8_t framebuffer[LCD_HEIGHT][LCD_WIDTH];
+  uint64_t lines_drawn;
+};
+
+static struct gb_s gb;
+
+uint8_t gb_rom_read(struct gb_s *gb, const uint_fast32_t addr) {
+  const struct priv_t * const p = gb->direct.priv;
+  return addr < p->rom_size ? p->rom[addr] : 0xFF;
+}
+
+void gb_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr, const uint8_t val) {
+  const struct priv_t * const p = gb->direct.priv;
+  p->cart_ram[addr] = val;
+}
+
+uint8_t gb_cart_ram_read(struct gb_s *gb, const uint_fast32_t addr) {
+  const struct priv_t * const p = gb->direct.priv;
+  return p->cart_ram[addr];
+}
+
+void gb_error(struct gb_s *gb, const enum gb_error_e gb_err, const uint16_t val) {
+  return;
+}
+
+static void lcd_draw_line(struct gb_s *gb, const uint8_t *pixels, const uint_fast8_t line) {
+  struct priv_t * const p = gb->direct.priv;
+  memcpy(p->framebuffer[line], pixels, LCD_WIDTH);
+  p->lines_drawn++;
+}
+
+// FNV-1a, folded over every frame so any divergence shows up in the result.
+static uint64_t hash_frame(uint64_t hash, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+// Deterministic input script: tap A regularly and hold directions now and
+// then, so that games leave their title screen and exercise gameplay code.
+static uint8_t joypad_for_frame(uint32_t frame) {
+  uint8_t joypad = 0xFF;
+  if (frame % 24 < 3) {
+    joypad &= ~0x01;  // A
+  }
+  if (frame % 600 == 300) {
+    joypad &= ~0x08;  // Start
+  }
+  if (frame % 240 >= 120 && frame % 240 < 140) {
+    joypad &= ~0x10;  // Right
+  }
+  return joypad;
+}
+
+// Test cartridge program, at 0x150:
+//         ld a, $0A
+//         ld ($0000), a     ; enable cartridge RAM
+//         ld c, 1
+// outer:  ld a, c
+//         and $1F
+//         jr nz, nonzero
+//         inc a
+// nonzero:ld ($2000), a     ; select ROM bank (low bits)
+//         xor a
+//         ld ($3000), a     ; MBC5 only: select ROM bank (bit 8)
+//         ld a, c
+//         and 3             ; 15 on MBC5, which has 16 RAM banks
+//         ld ($4000), a     ; select RAM bank
+//         ld hl, $4000
+//         ld b, 0
+// inner:  add a, (hl)       ; sum 256 bytes of the ROM bank
+//         inc hl
+//         dec b
+//         jr nz, inner
+//         ld hl, $A000
+//         add a, (hl)
+//         ld (hl), a        ; read and write cartridge RAM
+//         inc c
+//         jp outer
+static const uint8_t test_cart_code[] = {
+  0x3E, 0x0A, 0xEA, 0x00, 0x00, 0x0E, 0x01,
+  0x79, 0xE6, 0x1F, 0x20, 0x01, 0x3C, 0xEA, 0x00, 0x20,
+  0xAF, 0xEA, 0x00, 0x30,
+  0x79, 0xE6, 0x03, 0xEA, 0x00, 0x40,
+  0x21, 0x00, 0x40, 0x06, 0x00,
+  0x86, 0x23, 0x05, 0x20, 0xFB,
+  0x21, 0x00, 0xA0, 0x86, 0x77,
+  0x0C, 0xC3, 0x57, 0x01
+};
+
+// Offset of the MBC5 high bank select in test_cart_code.
+#define TEST_CART_MBC5_ONLY 16
+
+// Offset of the mask of the RAM bank selected in test_cart_code.
+#define TEST_CART_RAM_BANK_MASK 22
+
+// Builds a 512 KiB test cartridge with 32 KiB of RAM, or 128 KiB for MBC5,
+// for the MBC named mbc1, mbc3 or mbc5. Returns NULL for any other name.
+static uint8_t *make_test_cart(const char *name, size_t *size) {
+  uint8_t type;
+  if (strcmp(name, "mbc1") == 0) {
+    type = 0x03;  // MBC1+RAM+BATTERY
+  } else if (strcmp(name, "mbc3") == 0) {
+    type = 0x13;  // MBC3+RAM+BATTERY
+  } else if (strcmp(name, "mbc5") == 0) {
+    type = 0x1B;  // MBC5+RAM+BATTERY
+  } else {
+    return NULL;
+  }
+
+  *size = 0x80000;
+  uint8_t *rom = malloc(*size);
+  for (size_t i = 0; i < *size; i++) {
+    rom[i] = (i / 0x4000 * 7 + i) & 0xFF;
+  }
+  memset(rom, 0, 0x150);
+
+  // Entry point, header and program
+  const uint8_t entry[] = {0x00, 0xC3, 0x50, 0x01};
+  memcpy(&rom[0x100], entry, sizeof(entry));
+  memcpy(&rom[0x134], "BENCH", 5);
+  rom[0x147] = type;
+  rom[0x148] = 0x04;  // 32 banks
+  rom[0x149] = type == 0x1B ? 0x04 : 0x03;  // 16 or 4 RAM banks
+  uint8_t checksum = 0;
+  for (uint16_t i = 0x134; i <= 0x14C; i++) {
+    checksum = checksum - rom[i] - 1;
+  }
+  rom[0x14D] = checksum;
+  memcpy(&rom[0x150], test_cart_code, sizeof(test_cart_code));
+  if (type != 0x1B) {
+    // Writing to 0x3000 would select a ROM bank on MBC1 and MBC3
+    memset(&rom[0x150 + TEST_CART_MBC5_ONLY], 0x00, 4);
+  } else {
+    rom[0x150 + TEST_CART_RAM_BANK_MASK] = 0x0F;
+  }
+  return rom;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s ROM|mbc1|mbc3|mbc5 [frames]\n", argv[0]);
+    return 1;
+  }
+  uint32_t frames = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : DEFAULT_FRAMES;
+
+  static struct priv_t priv;
+  priv.rom = make_test_cart(argv[1], &priv.rom_size);
+  if (priv.rom == NULL) {
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL) {
+      perror(argv[1]);
+      return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    priv.rom_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    priv.rom = malloc(priv.rom_size);
+    if (priv.rom == NULL || fread(priv.rom, 1, priv.rom_size, f) != priv.rom_size) {
+      fprintf(stderr, "%s: read error\n", argv[1]);
+      return 1;
+    }
+    fclose(f);
+  }
+
+  int ret = gb_init(&gb, gb_rom_read, gb_cart_ram_read, gb_cart_ram_write, gb_error, &priv);
+  if (ret != GB_INIT_NO_ERROR) {
+    fprintf(stderr, "gb_init failed: %d\n", ret);
+    return 1;
+  }
+
+  gb_init_rom(&gb, priv.rom, priv.rom_size);
+
+  size_t save_size = gb_get_save_size(&gb);
+  priv.cart_ram = malloc(save_size ? save_size : 1);
+  memset(priv.cart_ram, 0xFF, save_size);
+  gb_init_cart_ram(&gb, BENCH_CART_RAM_CALLBACKS ? NULL : priv.cart_ram, save_size);
+
+  gb_init_lcd(&gb, lcd_draw_line);
+
+  uint64_t hash = 0xCBF29CE484222325ULL;
+#if ENABLE_IDLE_LOOP_DETECTION
+  uint64_t idle_hits = 0;
+  uint64_t idle_cycles = 0;
+#endif
+#if ENABLE_BLOCK_CACHE
+  uint64_t block_hits = 0;
+  uint64_t block_misses = 0;
+  uint64_t instructions = 0;
+#endif
+  double start = now_seconds();
+  for (uint32_t frame = 0; frame < frames; frame++) {
+    gb.direct.joypad = joypad_for_frame(frame);
+    gb_run_frame(&gb);
+    hash = hash_frame(hash, &priv.framebuffer[0][0], sizeof(priv.framebuffer));
+#if ENABLE_IDLE_LOOP_DETECTION
+    idle_hits += gb.idle.hits;
+    idle_cycles += gb.idle.skipped_cycles >> gb.cgb.doubleSpeed;
+#endif
+#if ENABLE_BLOCK_CACHE
+    block_hits += gb.block_cache.hits;
+    block_misses += gb.block_cache.misses;
+    instructions += gb.block_cache.instructions;
+#endif
+  }
+  double elapsed = now_seconds() - start;
+
+  printf("frames:  %u\n", frames);
+  printf("time:    %.3f s\n", elapsed);
+  printf("speed:   %.1f frames/s (%.2fx real time)\n", frames / elapsed, frames / elapsed / VERTICAL_SYNC);
+  printf("lines:   %.1f drawn/frame\n", (double)priv.lines_drawn / frames);
+#if ENABLE_IDLE_LOOP_DETECTION
+  printf("idle:    %.1f loops/frame, %.1f%% of cycles skipped\n", (double)idle_hits / frames,
+         100.0 * idle_cycles / frames / SCREEN_REFRESH_CYCLES);
+#endif
+#if ENABLE_BLOCK_CACHE
+  printf("blocks:  %.2f%% hit rate, %.1f instructions/block\n",
+         100.0 * block_hits / (block_hits + block_misses),
+         (double)instructions / (block_hits + block_misses));
+  printf("cpu:     %.1f MIPS\n", instructions / elapsed / 1e6);
+#endif
+  printf("hash:    %016llx\n", (unsigned long long)hash);
+
+  // Cartridge RAM and CPU registers at the end, as the test cartridges do
+  // not draw anything.
+  const uint16_t regs[] = {gb.cpu_reg.a, gb.cpu_reg.bc, gb.cpu_reg.de, gb.cpu_reg.hl, gb.cpu_reg.sp, gb.cpu_reg.pc};
+  uint64_t state = hash_frame(0xCBF29CE484222325ULL, priv.cart_ram, save_size);
+  state = hash_frame(state, (const uint8_t *)regs, sizeof(regs));
+  printf("state:   %016llx\n", (unsigned long long)state);
+#if ENABLE_OP_PROFILE
+  // One line per opcode pair run, for make profile-pairs to add up.
+  for (int first = 0; first < 0x100; first++) {
+    for (int second = 0; second < 0x100; second++) {
+      if (gb.op_profile.pairs[first][second] != 0) {
+        printf("pair:    %02X %02X %lu\n", first, second, (unsigned long)gb.op_profile.pairs[first][second]);
+      }
+    }
+  }
+#endif
+
+  return 0;
+}
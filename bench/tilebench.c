@@ -0,0 +1,122 @@
+// Microbenchmark of the conversion of tile rows to pixels.
+//
+// Compares the per-bit loop that Peanut-GB used to turn the two bitplane
+// bytes of a tile row into 8 coloured pixels with the word-at-a-time kernel
+// of peanut_gb.h, __gb_tile_pixels() and __gb_map_pixels(), both from the
+// bitplanes and from rows already decoded by the tile cache, and checks that
+// they draw the same pixels:
+//
+//   make tilebench
+//   output/host/tilebench [rounds]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "peanut_gb/peanut_gb.h"
+
+#define DEFAULT_ROUNDS 20000
+
+// Tile rows converted each round, as many as on a line of 20 tiles.
+#define ROWS 20
+
+struct tile_row_t {
+  uint8_t lo, hi, flip;
+  uint16_t decoded;
+};
+
+static struct tile_row_t rows[ROWS];
+static const uint8_t palette[4] = {0, 2, 1, 3};
+static uint8_t line[ROWS * 8];
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The per-bit loop: one pixel per iteration, shifting both bitplanes.
+static void draw_per_bit(void) {
+  for (int r = 0; r < ROWS; r++) {
+    uint8_t t1 = rows[r].lo;
+    uint8_t t2 = rows[r].hi;
+    for (int i = 0; i < 8; i++) {
+      uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+      int x = rows[r].flip ? i : 7 - i;
+      line[8 * r + x] = palette[c] | LCD_PALETTE_BG;
+      t1 >>= 1;
+      t2 >>= 1;
+    }
+  }
+}
+
+static GB_ALWAYS_INLINE void draw_row(int r, uint_fast16_t row, const uint32_t map[4]) {
+  uint32_t tile[2];
+  __gb_tile_pixels(row, rows[r].flip, tile);
+  tile[0] = __gb_map_pixels(tile[0], map);
+  tile[1] = __gb_map_pixels(tile[1], map);
+  memcpy(&line[8 * r], tile, sizeof(tile));
+}
+
+// The kernel, decoding the bitplanes first.
+static void draw_kernel(void) {
+  uint32_t map[4];
+  __gb_pixel_map(palette, LCD_PALETTE_BG, map);
+  for (int r = 0; r < ROWS; r++) {
+    draw_row(r, __gb_decode_tile_row(rows[r].lo, rows[r].hi), map);
+  }
+}
+
+// The kernel, from rows decoded by the tile cache.
+static void draw_kernel_decoded(void) {
+  uint32_t map[4];
+  __gb_pixel_map(palette, LCD_PALETTE_BG, map);
+  for (int r = 0; r < ROWS; r++) {
+    draw_row(r, rows[r].decoded, map);
+  }
+}
+
+// Runs draw over fresh random rows each round, returning the time taken and
+// a hash of the pixels drawn.
+static double run(void (*draw)(void), uint32_t rounds, uint64_t *hash) {
+  uint32_t seed = 1;
+  *hash = 0xCBF29CE484222325ULL;
+  double elapsed = 0;
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (int r = 0; r < ROWS; r++) {
+      seed = seed * 1103515245 + 12345;
+      rows[r].lo = seed >> 8;
+      rows[r].hi = seed >> 16;
+      rows[r].flip = (seed >> 24) & 1;
+      rows[r].decoded = __gb_decode_tile_row(rows[r].lo, rows[r].hi);
+    }
+    double start = now_seconds();
+    for (int i = 0; i < 64; i++) {
+      draw();
+    }
+    elapsed += now_seconds() - start;
+    for (size_t i = 0; i < sizeof(line); i++) {
+      *hash = (*hash ^ line[i]) * 0x100000001B3ULL;
+    }
+  }
+  return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t rounds = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : DEFAULT_ROUNDS;
+  uint64_t rows_drawn = (uint64_t)rounds * 64 * ROWS;
+  uint64_t expected, got;
+
+  double per_bit = run(draw_per_bit, rounds, &expected);
+  double kernel = run(draw_kernel, rounds, &got);
+  int same = got == expected;
+  double decoded = run(draw_kernel_decoded, rounds, &got);
+  same = same && got == expected;
+
+  printf("per-bit loop:    %.2f ns/row\n", per_bit / rows_drawn * 1e9);
+  printf("kernel:          %.2f ns/row (%.2fx)\n", kernel / rows_drawn * 1e9, per_bit / kernel);
+  printf("kernel, decoded: %.2f ns/row (%.2fx)\n", decoded / rows_drawn * 1e9, per_bit / decoded);
+  printf("pixels:          %s\n", same ? "identical" : "DIFFERENT");
+  return same ? 0 : 1;
+}
@@ -15,6 +15,11 @@
 #define AUTOMATIC_FRAME_SKIPPING 1
 // Useful when AUTOMATIC_FRAME_SKIPPING is disabled
 #define FRAME_SKIPPING_DEFAULT_STATE false
+// Screen rows, of the full screen width, gathered before pushing them in one
+// rectangle, as each push has a fixed cost. Takes 640 bytes of RAM per row:
+// 240 holds a whole frame, and at least 2 are needed for the Game Boy lines
+// drawn on 2 rows by the scalings larger than 1:1
+#define STRIP_ROWS 24
 
 const char eadk_app_name[] __attribute__((section(".rodata.eadk_app_name"))) = "Game Boy";
 const uint32_t eadk_api_level  __attribute__((section(".rodata.eadk_api_level"))) = 0;
@@ -60,68 +65,161 @@ eadk_color_t palette_worst_ever[4] = {0xf7e7, 0x7e0, 0xfa7a, 0x1f};
 eadk_color_t all_palettes[7] = {&palette_peanut_GB,&palette_original,&palette_gray, &palette_gray_negative,&palette_virtual_boy,&palette_virtual_boy_inv,&palette_worst_ever};
 eadk_color_t * palette = palette_original;
 
-inline eadk_color_t eadk_color_from_gb_pixel(uint8_t gb_pixel) {
-    uint8_t gb_color = gb_pixel & 0x3;
-    return palette[gb_color];
+// Screen rows of consecutive Game Boy lines, waiting to be pushed
+static struct {
+  // Screen area of the rows, none when its height is 0
+  eadk_rect_t rect;
+  // Game Boy line that comes right after the rows
+  uint_fast8_t next_line;
+  eadk_color_t pixels[STRIP_ROWS * EADK_SCREEN_WIDTH];
+} strip;
+
+// Pushes made and time spent in them, for the frame time display. Pushes
+// take less than the 1 ms resolution of the timer, so they are averaged over
+// PUSH_STATS_FRAMES frames
+#define PUSH_STATS_FRAMES 16
+static uint32_t pushCount = 0;
+static uint64_t pushMillis = 0;
+
+static void strip_flush() {
+  if (strip.rect.height == 0) {
+    return;
+  }
+  uint64_t start = eadk_timing_millis();
+  eadk_display_push_rect(strip.rect, strip.pixels);
+  pushMillis += eadk_timing_millis() - start;
+  pushCount++;
+  strip.rect.height = 0;
 }
 
-static void lcd_draw_line_centered(struct gb_s* gb, const uint8_t* input_pixels, const uint_fast8_t line) {
-    eadk_color_t output_pixels[LCD_WIDTH];
-    eadk_point_t point = { 0, line };
-
-    //fix each pixel with gb->cgb.fixPalette
-    #pragma unroll 40
-    for (int i = 0; i < LCD_WIDTH; i++) {
-        if (gb->cgb.cgbMode) {
-            output_pixels[i] = gb->cgb.fixPalette[input_pixels[i]];
-            output_pixels[i] = (output_pixels[i] & 0x1F) << 11 | (output_pixels[i] & 0x3E0) << 1 | (output_pixels[i] & 0x7C00) >> 10;
-            output_pixels[i] = (output_pixels[i] & 0x1F) << 11 | (output_pixels[i] & 0x7E0) | (output_pixels[i] & 0xF800) >> 11;
-        }
-        else {
-            output_pixels[i] = eadk_color_from_gb_pixel(input_pixels[i]);
-        }
-    }
-    //dump output_pixels to screen
-    eadk_display_push_rect((eadk_rect_t) { (EADK_SCREEN_WIDTH - LCD_WIDTH) / 2, (EADK_SCREEN_HEIGHT - LCD_HEIGHT) / 2 + line, LCD_WIDTH, 1 }, output_pixels);
+// Returns where to write the `rows` screen rows of Game Boy line `line`, at
+// screen position x, y and `width` pixels wide. The rows are added to the
+// strip, which is pushed first if they do not follow its rows or do not fit
+static eadk_color_t * strip_rows(uint_fast8_t line, uint16_t x, uint16_t y, uint16_t width, uint16_t rows) {
+  if (strip.rect.height != 0 && (line != strip.next_line || x != strip.rect.x || width != strip.rect.width ||
+                                 (strip.rect.height + rows) * width > STRIP_ROWS * EADK_SCREEN_WIDTH)) {
+    strip_flush();
+  }
+  if (strip.rect.height == 0) {
+    strip.rect = (eadk_rect_t){x, y, width, 0};
+  }
+  eadk_color_t * pixels = &strip.pixels[strip.rect.height * width];
+  strip.rect.height += rows;
+  strip.next_line = line + 1;
+  return pixels;
+}
+
+// Ways of scaling the Game Boy screen, from smallest to largest, switched
+// between with + and -
+enum scaling_e {
+  // 1:1, centred
+  SCALING_CENTERED,
+  // 5:3 in both directions, 266x240, keeping the aspect ratio
+  SCALING_ASPECT,
+  // 2:1 horizontally and 5:3 vertically, the whole 320x240 screen
+  SCALING_STRETCH,
+  // 2:1 in both directions, the top and bottom 12 lines cropped
+  SCALING_DOUBLE,
+  SCALING_COUNT
+};
 
+// Writes the screen row of a Game Boy line
+typedef void (*scale_row_t)(eadk_color_t * row, const uint16_t * pixels);
+
+// Tables of the current scaling, worked out once by scaling_set rather than
+// for every pixel drawn
+static struct {
+  enum scaling_e mode;
+  // Screen position of the rows
+  uint16_t x;
+  uint16_t width;
+  scale_row_t scale_row;
+  // Game Boy pixel shown in each screen column, for scale_row_map
+  uint8_t x_map[EADK_SCREEN_WIDTH];
+  // Screen row of each Game Boy line, and how many rows it covers (0 when
+  // cropped)
+  uint8_t y[LCD_HEIGHT];
+  uint8_t rows[LCD_HEIGHT];
+} scaling;
+
+static void scale_row_copy(eadk_color_t * row, const uint16_t * pixels) {
+  memcpy(row, pixels, LCD_WIDTH * sizeof(eadk_color_t));
 }
 
+// Both copies of a pixel are written at once
+static void scale_row_double(eadk_color_t * row, const uint16_t * pixels) {
+  for (int i = 0; i < LCD_WIDTH; i++) {
+    uint32_t pair = pixels[i] * 0x10001u;
+    memcpy(&row[2 * i], &pair, sizeof(pair));
+  }
+}
 
-void lcd_draw_line_dummy(struct gb_s *gb, const uint8_t pixels[LCD_WIDTH], const uint_fast8_t line) {}
+static void scale_row_map(eadk_color_t * row, const uint16_t * pixels) {
+  uint16_t width = scaling.width;
+  for (int i = 0; i < width; i++) {
+    row[i] = pixels[scaling.x_map[i]];
+  }
+}
 
-static void lcd_draw_line_maximized_ratio(struct gb_s * gb, const uint8_t * input_pixels, const uint_fast8_t line) {
-  // Nearest neighbor scaling of a 160x144 texture to a 266x240 resolution (to keep the ratio)
-  // Horizontally, we multiply by 1.66 (160*1.66 = 266)
-  eadk_color_t output_pixels[LCD_WIDTH];
-  uint16_t final_output_pixels[266];
+static const struct {
+  // Width of the screen rows
+  uint16_t width;
+  // Screen rows per Game Boy line, as a fraction
+  uint8_t rows_num;
+  uint8_t rows_den;
+  // Game Boy lines not shown, at the top and at the bottom
+  uint8_t cropped;
+  scale_row_t scale_row;
+} scaling_modes[SCALING_COUNT] = {
+  [SCALING_CENTERED] = {LCD_WIDTH, 1, 1, 0, scale_row_copy},
+  [SCALING_ASPECT] = {266, 5, 3, 0, scale_row_map},
+  [SCALING_STRETCH] = {EADK_SCREEN_WIDTH, 5, 3, 0, scale_row_double},
+  [SCALING_DOUBLE] = {EADK_SCREEN_WIDTH, 2, 1, 12, scale_row_double},
+};
 
-  #pragma unroll 40
-  for (int i=0; i<LCD_WIDTH; i++) {
-    if (gb->cgb.cgbMode) {
-        output_pixels[i] = gb->cgb.fixPalette[input_pixels[i]];
-        output_pixels[i] = (output_pixels[i] & 0x1F) << 11 | (output_pixels[i] & 0x3E0) << 1 | (output_pixels[i] & 0x7C00) >> 10;
-        output_pixels[i] = (output_pixels[i] & 0x1F) << 11 | (output_pixels[i] & 0x7E0) | (output_pixels[i] & 0xF800) >> 11;
-    }
-    else {
-        output_pixels[i] = eadk_color_from_gb_pixel(input_pixels[i]);
+static void scaling_set(enum scaling_e mode) {
+  uint16_t width = scaling_modes[mode].width;
+  uint8_t num = scaling_modes[mode].rows_num;
+  uint8_t den = scaling_modes[mode].rows_den;
+  uint8_t cropped = scaling_modes[mode].cropped;
+  uint16_t height = (LCD_HEIGHT - 2 * cropped) * num / den;
+
+  scaling.mode = mode;
+  scaling.x = (EADK_SCREEN_WIDTH - width) / 2;
+  scaling.width = width;
+  scaling.scale_row = scaling_modes[mode].scale_row;
+  for (int i = 0; i < width; i++) {
+    scaling.x_map[i] = i * LCD_WIDTH / width;
+  }
+  for (int line = 0; line < LCD_HEIGHT; line++) {
+    int shown = line - cropped;
+    if (shown < 0 || line >= LCD_HEIGHT - cropped) {
+      scaling.rows[line] = 0;
+      continue;
     }
-
-    eadk_color_t color = output_pixels[i];
-    // We can't use floats for performance reason, so we use a fixed point
-    // representation
-    final_output_pixels[166*i/100] = color;
-    // This line is useless 1/3 times, but using an if is slower
-    final_output_pixels[166*i/100+1] = color;
+    scaling.y[line] = (EADK_SCREEN_HEIGHT - height) / 2 + shown * num / den;
+    scaling.rows[line] = (shown + 1) * num / den - shown * num / den;
   }
+}
 
-  // Vertically, we want to scale by a 5/3 ratio. So we need to make 5 lines out of three:  we double two lines out of three.
-  uint16_t y = (5*line)/3;
-  eadk_display_push_rect((eadk_rect_t){(320 - 265) / 2, y, 265, 1}, final_output_pixels);
-  if (line%3 != 0) {
-    eadk_display_push_rect((eadk_rect_t){(320 - 265) / 2, y + 1, 265, 1}, final_output_pixels);
+// The core converts pixels to RGB565 with gb.display.rgb565: CGB colours are
+// set by the game, DMG shades by gb_set_rgb565_palette. The first screen row
+// of the line is scaled into the strip, and copied to the others
+static void lcd_draw_line_scaled(struct gb_s* gb, const uint16_t* pixels, const uint_fast8_t line) {
+  uint_fast8_t rows = scaling.rows[line];
+  if (rows == 0) {
+    return;
+  }
+  eadk_color_t * row = strip_rows(line, scaling.x, scaling.y[line], scaling.width, rows);
+  scaling.scale_row(row, pixels);
+  for (uint_fast8_t i = 1; i < rows; i++) {
+    memcpy(row + i * scaling.width, row, scaling.width * sizeof(eadk_color_t));
   }
 }
 
+
+void lcd_draw_line_dummy(struct gb_s *gb, const uint16_t pixels[LCD_WIDTH], const uint_fast8_t line) {}
+
 enum save_status_e {
   SAVE_READ_OK,
   SAVE_WRITE_OK,
@@ -242,15 +340,26 @@ int main(int argc, char * argv[]) {
     return -1;
   }
 
+  // The ROM is mapped in flash, so let the core read it without going through
+  // gb_rom_read for every byte
+  gb_init_rom(&gb, priv.rom, eadk_external_data_size);
+
   // Alloc and init save RAM.
   size_t save_size = gb_get_save_size(&gb);
   priv.cart_ram = read_save_file(save_size);
+  gb_init_cart_ram(&gb, priv.cart_ram, save_size);
 
-  gb_init_lcd(&gb, lcd_draw_line_maximized_ratio);
+  scaling_set(SCALING_ASPECT);
+  gb_init_lcd_rgb565(&gb, lcd_draw_line_scaled);
+  gb_set_rgb565_palette(&gb, palette);
 
   bool MSpFfCounter = false;
   bool wasMSpFPressed = false;
+  bool wasScalingPressed = false;
   uint32_t lastMSpF = 0;
+  uint32_t pushFrames = 0;
+  uint32_t pushesPerFrame = 0;
+  uint32_t pushTenthsPerFrame = 0;
 
   #if ENABLE_FRAME_LIMITER
   // We use a "smart" frame limiter: for each frame, we add
@@ -268,11 +377,11 @@ int main(int argc, char * argv[]) {
   
   // Skip 1/2 frame, spare 3 ms/f on my N0110
   bool frameSkipping = FRAME_SKIPPING_DEFAULT_STATE;
-  void * drawLineMode = lcd_draw_line_maximized_ratio;
 
   while (true) {
     uint64_t start = eadk_timing_millis();
     gb_run_frame(&gb);
+    strip_flush();
 
     eadk_keyboard_state_t kbd = eadk_keyboard_scan();
     gb.direct.joypad_bits.a = !eadk_keyboard_key_down(kbd, eadk_key_back);
@@ -314,19 +423,31 @@ int main(int argc, char * argv[]) {
       palette = all_palettes[index];
       index++;
     }
-    if (eadk_keyboard_key_down(kbd, eadk_key_plus)) {
-      gb.display.lcd_draw_line = lcd_draw_line_maximized_ratio;
-      drawLineMode = lcd_draw_line_maximized_ratio;
-    }
-    if (eadk_keyboard_key_down(kbd, eadk_key_minus)) {
-      eadk_display_push_rect_uniform(eadk_screen_rect, eadk_color_black);
-      gb.display.lcd_draw_line = lcd_draw_line_centered;
-      drawLineMode = lcd_draw_line_centered;
+    gb_set_rgb565_palette(&gb, palette);
+    // The core only draws the lines that changed, so it has to draw them all
+    // again whenever the screen is cleared or drawn differently
+    if (eadk_keyboard_key_down(kbd, eadk_key_plus) || eadk_keyboard_key_down(kbd, eadk_key_minus)) {
+      if (!wasScalingPressed) {
+        enum scaling_e mode = scaling.mode;
+        if (eadk_keyboard_key_down(kbd, eadk_key_plus) && mode + 1 < SCALING_COUNT) {
+          mode++;
+        }
+        if (eadk_keyboard_key_down(kbd, eadk_key_minus) && mode > 0) {
+          mode--;
+        }
+        if (mode != scaling.mode) {
+          eadk_display_push_rect_uniform(eadk_screen_rect, eadk_color_black);
+          scaling_set(mode);
+          gb_refresh_lcd(&gb);
+        }
+        wasScalingPressed = true;
+      }
+    } else {
+      wasScalingPressed = false;
     }
     // if (eadk_keyboard_key_down(kbd, eadk_key_division)) {
     //   eadk_display_push_rect_uniform(eadk_screen_rect, eadk_color_black);
-    //   gb.display.lcd_draw_line = lcd_draw_line_dummy;
-    //   drawLineMode = lcd_draw_line_dummy;
+    //   gb.display.lcd_draw_line_rgb565 = lcd_draw_line_dummy;
     // }
     if (eadk_keyboard_key_down(kbd, eadk_key_toolbox)) {
       write_save_file(priv.cart_ram, save_size);
@@ -336,6 +457,7 @@ int main(int argc, char * argv[]) {
         MSpFfCounter = !MSpFfCounter;
         wasMSpFPressed = true;
         eadk_display_push_rect_uniform(eadk_screen_rect, eadk_color_black);
+        gb_refresh_lcd(&gb);
       }
     } else {
       wasMSpFPressed = false;
@@ -353,6 +475,7 @@ int main(int argc, char * argv[]) {
 
       // Clear the screen as framebuffer is lost when the screen is shut down
       eadk_display_push_rect_uniform(eadk_screen_rect, eadk_color_black);
+      gb_refresh_lcd(&gb);
     }
     if (eadk_keyboard_key_down(kbd, eadk_key_zero)) {
       // Save and exit
@@ -366,24 +489,36 @@ int main(int argc, char * argv[]) {
 
     uint64_t end = eadk_timing_millis();
     uint16_t MSpF = (uint16_t)(end - start);
+    if (++pushFrames == PUSH_STATS_FRAMES) {
+      pushesPerFrame = pushCount / PUSH_STATS_FRAMES;
+      pushTenthsPerFrame = pushMillis * 10 / PUSH_STATS_FRAMES;
+      pushFrames = pushCount = pushMillis = 0;
+    }
     if (MSpFfCounter) {
       // We need to average the MSpF as skipped frames are faster
       uint16_t MSpFAverage = (MSpF + lastMSpF) / 2;
       char buffer[100];
-      sprintf(buffer, "%d ms/f", MSpFAverage);
+      // Time spent pushing to the screen, and in how many pushes
+      #if ENABLE_IDLE_LOOP_DETECTION
+      // Share of the last frame skipped in idle loops (a frame takes twice
+      // as many CPU cycles in CGB double speed mode)
+      uint32_t frameCycles = (uint32_t)SCREEN_REFRESH_CYCLES << gb.cgb.doubleSpeed;
+      uint32_t idlePercent = gb.idle.skipped_cycles * 100 / frameCycles;
+      sprintf(buffer, "%d ms/f, push %d.%d ms/f in %d, %d%% idle", MSpFAverage, (int)pushTenthsPerFrame / 10,
+              (int)pushTenthsPerFrame % 10, (int)pushesPerFrame, (int)idlePercent);
+      #else
+      sprintf(buffer, "%d ms/f, push %d.%d ms/f in %d", MSpFAverage, (int)pushTenthsPerFrame / 10,
+              (int)pushTenthsPerFrame % 10, (int)pushesPerFrame);
+      #endif
       // sprintf(buffer, "%d ms/f, %d ", MSpFAverage, timeBudget);
       eadk_point_t location = {2, 230};
       eadk_display_draw_string(buffer, location, false, eadk_color_white, eadk_color_black);
     }
 
-    if (frameSkipping) {
-      if (gb.display.lcd_draw_line != lcd_draw_line_dummy) {
-        drawLineMode = gb.display.lcd_draw_line;
-        gb.display.lcd_draw_line = lcd_draw_line_dummy;
-      } else {
-        gb.display.lcd_draw_line = drawLineMode;
-      }
-    }
+    // Let the core skip every other frame, without drawing its lines, rather
+    // than drawing them to a dummy function, which would keep them from being
+    // drawn on the next frame if they do not change
+    gb.direct.frame_skip = frameSkipping;
 
     #if ENABLE_FRAME_LIMITER
     uint32_t differenceToTarget = abs(TARGET_FRAME_DURATION - MSpF);
@@ -409,7 +544,6 @@ int main(int argc, char * argv[]) {
         #if AUTOMATIC_FRAME_SKIPPING
         // Disable frame skipping as we are running faster than required
         frameSkipping = false;
-        gb.display.lcd_draw_line = drawLineMode;
         #endif
       }
     } else {
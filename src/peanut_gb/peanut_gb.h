@@ -49,6 +49,142 @@
 #define ENABLE_LCD 1
 #endif
 
+/**
+ * Detect loops that only poll for a change made by the LCD, timer or serial
+ * port (LY, STAT or IF polling, waiting for a flag set by an interrupt
+ * handler), and skip their iterations up to the next peripheral event. On by
+ * default.
+ */
+#ifndef ENABLE_IDLE_LOOP_DETECTION
+#define ENABLE_IDLE_LOOP_DETECTION 1
+#endif
+
+/**
+ * Keep the tiles of VRAM decoded into 2-bit colour indices, decoding again
+ * only the tiles written since they were last drawn, so that drawing a line
+ * does not decode tiles bit by bit. Costs 13 KiB. On by default when the LCD
+ * is enabled.
+ */
+#ifndef ENABLE_TILE_CACHE
+#define ENABLE_TILE_CACHE ENABLE_LCD
+#endif
+
+/**
+ * Skip drawing a line when the registers, palettes, tile map row, tiles and
+ * sprites it shows are the same as when it was last drawn, leaving the copy
+ * the front-end already has on screen. Front-ends must call gb_refresh_lcd()
+ * when that copy is lost, such as after clearing the screen. Needs the tile
+ * cache, which tracks writes to VRAM. On by default with the tile cache.
+ */
+#ifndef ENABLE_LINE_SKIP
+#define ENABLE_LINE_SKIP ENABLE_TILE_CACHE
+#endif
+
+#if ENABLE_LINE_SKIP && !ENABLE_TILE_CACHE
+#error "ENABLE_LINE_SKIP needs ENABLE_TILE_CACHE"
+#endif
+
+/**
+ * Draw the lines of a frame in one go at VBlank, each with the registers it
+ * was shown with, instead of between instructions as the LCD reaches them,
+ * so that drawing and running the CPU do not evict each other from the
+ * caches. A write to VRAM, OAM or a CGB palette during the frame draws the
+ * lines so far, and the rest of the frame line by line. Needs the tile
+ * cache, which routes all writes to VRAM through __gb_write(). Off by
+ * default.
+ */
+#ifndef ENABLE_DEFERRED_LINES
+#define ENABLE_DEFERRED_LINES 0
+#endif
+
+#if ENABLE_DEFERRED_LINES && !ENABLE_TILE_CACHE
+#error "ENABLE_DEFERRED_LINES needs ENABLE_TILE_CACHE"
+#endif
+
+/**
+ * Only draw the first MAX_SPRITES_LINE sprites of each line in OAM order, as
+ * the hardware does. Some games rely on it to hide sprites. On by default.
+ */
+#ifndef ENABLE_SPRITE_LIMIT
+#define ENABLE_SPRITE_LIMIT 1
+#endif
+
+/**
+ * Dispatch opcodes with a table of label addresses (GCC labels as values),
+ * each instruction jumping straight to the next one, instead of going back
+ * through a switch statement. On by default with compilers supporting it.
+ */
+#ifndef ENABLE_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define ENABLE_COMPUTED_GOTO 1
+#else
+#define ENABLE_COMPUTED_GOTO 0
+#endif
+#endif
+
+/**
+ * Evaluate the flags lazily: instructions store the result a flag depends on
+ * instead of computing the flag, and the flag register is only built when it
+ * is read, as by PUSH AF. cpu_reg.f is then not kept up to date. Saves the
+ * read-modify-write of the flag bits on targets where it is costly. Off by
+ * default.
+ */
+#ifndef ENABLE_LAZY_FLAGS
+#define ENABLE_LAZY_FLAGS 0
+#endif
+
+/**
+ * Keep the code run from ROM decoded into blocks of label addresses and
+ * cycle counts, up to the next branch, so that running a block does not fetch
+ * and decode its opcodes again. Code in RAM is still run an opcode at a time.
+ * Only pays off where reading the ROM is slow, as the mapped ROM pages
+ * otherwise make fetching about as cheap. Needs ENABLE_COMPUTED_GOTO. Off by
+ * default.
+ */
+#ifndef ENABLE_BLOCK_CACHE
+#define ENABLE_BLOCK_CACHE 0
+#endif
+
+/**
+ * Number of blocks kept by the block cache (a power of two), and maximum
+ * number of instructions in a block. The cache takes about
+ * BLOCK_CACHE_SIZE * BLOCK_CACHE_OPS * 8 bytes on 32-bit targets.
+ */
+#ifndef BLOCK_CACHE_SIZE
+#define BLOCK_CACHE_SIZE 256
+#endif
+#ifndef BLOCK_CACHE_OPS
+#define BLOCK_CACHE_OPS 16
+#endif
+
+#if ENABLE_BLOCK_CACHE && !ENABLE_COMPUTED_GOTO
+#error "ENABLE_BLOCK_CACHE needs ENABLE_COMPUTED_GOTO"
+#endif
+
+/**
+ * Check for the opcode that most often follows an instruction before going
+ * through the dispatch table, so that the pairs found by ENABLE_OP_PROFILE
+ * (see make profile-pairs) run with a single indirect jump. Needs
+ * ENABLE_COMPUTED_GOTO. On by default with it.
+ */
+#ifndef ENABLE_OP_PAIRS
+#define ENABLE_OP_PAIRS ENABLE_COMPUTED_GOTO
+#endif
+
+/**
+ * Count how often each opcode is followed by each other one in
+ * op_profile.pairs, to find the pairs worth fusing. Costs 256 KiB, meant for
+ * host builds. Needs ENABLE_COMPUTED_GOTO, without ENABLE_BLOCK_CACHE. Off by
+ * default.
+ */
+#ifndef ENABLE_OP_PROFILE
+#define ENABLE_OP_PROFILE 0
+#endif
+
+#if ENABLE_OP_PROFILE && (!ENABLE_COMPUTED_GOTO || ENABLE_BLOCK_CACHE)
+#error "ENABLE_OP_PROFILE needs ENABLE_COMPUTED_GOTO without ENABLE_BLOCK_CACHE"
+#endif
+
 /* Interrupt masks */
 #define VBLANK_INTR 0x01
 #define LCDC_INTR 0x02
@@ -78,6 +214,15 @@
 #define HRAM_ADDR 0xFF80
 #define INTR_EN_ADDR 0xFFFF
 
+/* Memory map granularity: one entry per 4 KiB page of the address space. */
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_PAGES (0x10000 >> MEM_PAGE_SHIFT)
+
+/* Start of an empty fetch window, away from any address. See FETCH_UPDATE(). */
+#define FETCH_NONE 0x20000
+
 /* Cart section sizes */
 #define ROM_BANK_SIZE 0x4000
 #define WRAM_BANK_SIZE 0x1000
@@ -88,6 +233,9 @@
  * 4194304 / 16384 = 256 clock cycles for one increment. */
 #define DIV_CYCLES 256
 
+/* Longest loop, in bytes, considered by the idle loop detection. */
+#define IDLE_LOOP_MAX_BYTES 16
+
  /* Serial clock locked to 8192Hz on DMG.
   * 4194304 / (8192 / 8) = 4096 clock cycles for sending 1 byte. */
 #define SERIAL_CYCLES 4096
@@ -136,6 +284,8 @@
 #define VRAM_BMAP_2 (0x9C00 - VRAM_ADDR)
 #define VRAM_TILES_3 (0x8000 - VRAM_ADDR + VRAM_BANK_SIZE)
 #define VRAM_TILES_4 (0x8800 - VRAM_ADDR + VRAM_BANK_SIZE)
+#define VRAM_TILE_DATA_SIZE 0x1800
+#define VRAM_TILE_SIZE 0x10
 
 /* Interrupt jump addresses */
 #define VBLANK_INTR_ADDR 0x0040
@@ -147,6 +297,11 @@
 /* SPRITE controls */
 #define NUM_SPRITES 0x28
 #define MAX_SPRITES_LINE 0x0A
+#if ENABLE_SPRITE_LIMIT
+#define SPRITES_LIST_SIZE MAX_SPRITES_LINE
+#else
+#define SPRITES_LIST_SIZE NUM_SPRITES
+#endif
 #define OBJ_PRIORITY 0x80
 #define OBJ_FLIP_Y 0x40
 #define OBJ_FLIP_X 0x20
@@ -156,10 +311,21 @@
 
 #define ROM_HEADER_CHECKSUM_LOC 0x014D
 
+/* Force inlining of the functions specialised with constant arguments. */
+#if defined(__GNUC__)
+#define GB_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define GB_ALWAYS_INLINE inline
+#endif
+
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
 struct cpu_registers_s {
     /* Combine A and F registers. */
     union {
@@ -182,6 +348,20 @@ struct cpu_registers_s {
         uint16_t af;
     };
 
+#if ENABLE_LAZY_FLAGS
+    /* Flags when evaluated lazily, see FLAG_Z and the like. */
+    union {
+        struct
+        {
+            uint8_t z; /* Zero flag is set when this is zero. */
+            uint8_t n; /* Add/sub flag. */
+            uint8_t h; /* Half carry flag is bit 4 of this. */
+            uint8_t c; /* Carry flag. */
+        };
+        uint32_t state;
+    } f_lazy;
+#endif
+
     union {
         struct
         {
@@ -215,15 +395,30 @@ struct cpu_registers_s {
 
 struct count_s {
     uint_fast16_t lcd_count;    /* LCD Timing */
-    uint_fast16_t div_count;    /* Divider Register Counter */
-    uint_fast16_t tima_count;   /* Timer Counter */
+    uint_fast16_t tima_count;   /* Timer Counter, as of tima_time */
     uint_fast16_t serial_count; /* Serial Counter */
+
+    /* CPU cycles applied to the timers, serial port and LCD since reset. */
+    uint_fast32_t total;
+    /* CPU cycles not yet applied to the timers, serial port and LCD. */
+    uint_fast16_t pending;
+    /* CPU cycles until the next peripheral event must be processed. */
+    uint_fast16_t next_event;
+
+    /* DIV and TIMA are worked out from the cycles run only when needed, see
+     * __gb_div() and __gb_update_tima(). DIV is the cycles run divided by
+     * DIV_CYCLES, plus div_offset. TIMA was last brought up to date when
+     * tima_time cycles had been run, and next overflows tima_overflow
+     * cycles after that. */
+    uint8_t div_offset;
+    uint_fast32_t tima_time;
+    uint_fast32_t tima_overflow;
 };
 
 struct gb_registers_s {
     /* TODO: Sort variables in address order. */
     /* Timing */
-    uint8_t TIMA, TMA, DIV;
+    uint8_t TIMA, TMA;
     union {
         struct
         {
@@ -310,6 +505,27 @@ enum gb_serial_rx_ret_e {
     GB_SERIAL_RX_NO_CONNECTION = 1
 };
 
+#if ENABLE_BLOCK_CACHE
+/**
+ * Block of ROM code decoded by __gb_decode_block(): the instructions from
+ * addr up to the next conditional or indirect jump, call, return, HALT, STOP
+ * or EI, following unconditional jumps.
+ */
+struct gb_block_s {
+    /* ROM address of the first instruction, with the bank it is in, or
+     * BLOCK_NONE for an unused block. */
+    uint32_t addr;
+    uint8_t count;
+    struct gb_block_op_s {
+        /* Label of the instruction in __gb_run_cpu(). */
+        const void* label;
+        uint8_t cycles;
+    } ops[BLOCK_CACHE_OPS];
+};
+
+#define BLOCK_NONE UINT32_MAX
+#endif
+
 /**
  * Emulator context.
  *
@@ -373,9 +589,21 @@ struct gb_s {
         uint8_t lcd_blank : 1;
     };
 
+    /* ROM contents, when the front-end has all of it in memory. NULL if it
+     * must be read with gb_rom_read(). */
+    const uint8_t* rom;
+    uint_fast32_t rom_size;
+    /* Cartridge RAM contents, when the front-end keeps it in memory. NULL
+     * if it must be accessed with gb_cart_ram_read() and
+     * gb_cart_ram_write(). */
+    uint8_t* sram;
+    uint_fast32_t sram_size;
+
     /* Cartridge information:
      * Memory Bank Controller (MBC) type. */
     uint8_t mbc;
+    /* Handler of writes to the MBC for this type, set by gb_init(). */
+    void (*mbc_write)(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val);
     /* Whether the MBC has internal RAM. */
     uint8_t cart_ram;
     /* Number of ROM banks in cartridge. */
@@ -384,9 +612,11 @@ struct gb_s {
     uint8_t num_ram_banks;
 
     uint16_t selected_rom_bank;
+    /* Offset in the ROM of the bank mapped at 0x4000, for the MBC mode. */
+    uint_fast32_t rom_bank_offset;
     /* WRAM and VRAM bank selection not available. */
     uint8_t cart_ram_bank;
-    uint16_t cart_ram_bank_offset;  //offset to subtract from the address to point to the right SRAM bank
+    int_fast32_t cart_ram_bank_offset;  //offset to subtract from the address to point to the right SRAM bank, negative from bank 6
     uint8_t enable_cart_ram;
     /* Cartridge ROM/RAM mode select. */
     uint8_t cart_mode_select;
@@ -406,12 +636,37 @@ struct gb_s {
     struct gb_registers_s gb_reg;
     struct count_s counter;
 
+    /**
+     * Memory map: for each page of the address space, the memory that backs
+     * it, or NULL when accesses need special handling (memory bank
+     * controller, IO registers...). Rebuilt by __gb_update_mem_map() whenever
+     * a bank changes.
+     */
+    struct {
+        const uint8_t* read[MEM_PAGES];
+        uint8_t* write[MEM_PAGES];
+    } mem_map;
+
     /* TODO: Allow implementation to allocate WRAM, VRAM and Frame Buffer. */
     uint8_t wram[WRAM_SIZE];
     uint8_t vram[VRAM_SIZE];
     uint8_t hram[HRAM_SIZE];
     uint8_t oam[OAM_SIZE];
 
+#if ENABLE_TILE_CACHE
+    /* Decoded tile rows of both VRAM banks, see __gb_decode_tile_row(), and
+     * whether each tile was written since it was decoded. */
+    uint16_t tile_rows[2][VRAM_TILE_DATA_SIZE / 2];
+    uint8_t tile_dirty[2][VRAM_TILE_DATA_SIZE / VRAM_TILE_SIZE];
+#endif
+
+#if ENABLE_LINE_SKIP
+    /* Count of writes to each tile of both VRAM banks, and to each row of
+     * both tile maps, attributes included, see __gb_line_signature(). */
+    uint16_t tile_version[2][VRAM_TILE_DATA_SIZE / VRAM_TILE_SIZE];
+    uint16_t map_version[(VRAM_BANK_SIZE - VRAM_BMAP_1) / 0x20];
+#endif
+
     struct
     {
         /**
@@ -437,6 +692,26 @@ struct gb_s {
             const uint8_t* pixels,
             const uint_fast8_t line);
 
+        /**
+         * Draw line on screen, in RGB565 colours. Used instead of
+         * lcd_draw_line when set, see gb_init_lcd_rgb565().
+         *
+         * \param gb_s        emulator context
+         * \param pixels    The 160 pixels to draw.
+         * \param line        Line to draw pixels on.
+         */
+        void (*lcd_draw_line_rgb565)(struct gb_s* gb,
+            const uint16_t* pixels,
+            const uint_fast8_t line);
+
+        /* RGB565 colour of each value passed to lcd_draw_line. Set by
+         * gb_set_rgb565_palette() for DMG games, and by the palette
+         * registers for CGB games. */
+        uint16_t rgb565[0x40];
+
+        /* Line renderer for the type of game, set by gb_init(). */
+        void (*draw_line)(struct gb_s* gb);
+
         /* Palettes */
         uint8_t bg_palette[4];
         uint8_t sp_palette[8];
@@ -444,11 +719,79 @@ struct gb_s {
         uint8_t window_clear;
         uint8_t WY;
 
+        /* Sprites on each line in OAM order, rebuilt by
+         * __gb_update_sprite_lines() when sprites_dirty is set. */
+        uint8_t sprite_count[LCD_HEIGHT];
+        uint8_t sprite_list[LCD_HEIGHT][SPRITES_LIST_SIZE];
+        uint8_t sprites_dirty;
+
+#if ENABLE_LINE_SKIP
+        /* Signature of each line when it was last drawn, and a count
+         * mixed into all of them, changed to draw every line again. */
+        uint32_t line_signature[LCD_HEIGHT];
+        uint32_t version;
+#endif
+
+#if ENABLE_DEFERRED_LINES
+        /* Registers of each line waiting to be drawn, see
+         * __gb_draw_deferred_lines(), and whether the rest of the frame
+         * is drawn line by line instead. */
+        struct gb_line_regs_s
+        {
+            uint8_t LY, LCDC, SCX, SCY, WX, BGP, OBP0, OBP1;
+        } deferred[LCD_HEIGHT];
+        uint8_t deferred_count;
+        uint8_t deferred_off;
+#endif
+
         /* Only support 30fps frame skip. */
         uint8_t frame_skip_count : 1;
         uint8_t interlace_count : 1;
     } display;
 
+#if ENABLE_IDLE_LOOP_DETECTION
+    /* Idle loop detection. */
+    struct {
+        /* Loops skipped, and CPU cycles skipped, during the last frame. */
+        uint_fast32_t hits;
+        uint_fast32_t skipped_cycles;
+
+        /* CPU state at the start of the last iteration of the loop. */
+        uint_fast32_t cycles;
+        uint16_t pc;
+        uint16_t af, bc, de, hl, sp;
+#if ENABLE_LAZY_FLAGS
+        /* Flags as left by the iteration, see cpu_reg.f_lazy. */
+        uint32_t f_lazy;
+#endif
+        uint8_t ime;
+        /* Set when the iteration did anything that could make the next
+         * one behave differently: memory write, DIV or TIMA read, or a
+         * peripheral event. */
+        uint8_t dirty;
+    } idle;
+#endif
+
+#if ENABLE_OP_PROFILE
+    /* Number of times each opcode was followed by each other one, since the
+     * last reset: pairs[first][second]. */
+    struct {
+        uint32_t pairs[0x100][0x100];
+    } op_profile;
+#endif
+
+#if ENABLE_BLOCK_CACHE
+    struct {
+        struct gb_block_s blocks[BLOCK_CACHE_SIZE];
+
+        /* Blocks found in the cache, blocks decoded, and instructions run,
+         * during the last frame. */
+        uint_fast32_t hits;
+        uint_fast32_t misses;
+        uint_fast32_t instructions;
+    } block_cache;
+#endif
+
     /* Game Boy Color Mode*/
     struct {
         uint8_t cgbMode;
@@ -548,10 +891,180 @@ void gb_set_rtc(struct gb_s* gb, const struct tm* const time) {
     gb->cart_rtc[4] = time->tm_yday >> 8;   /* High 1 bit of day counter. */
 }
 
+void __gb_sync(struct gb_s* gb);
+uint8_t __gb_div(const struct gb_s* gb);
+void __gb_update_tima(struct gb_s* gb);
+
+/**
+ * Internal function used to point the memory map at the currently selected
+ * VRAM, WRAM and cartridge banks.
+ */
+void __gb_update_mem_map(struct gb_s* gb) {
+    const uint_fast32_t bank = (gb->mbc == 1 && gb->cart_mode_select) ?
+        (gb->selected_rom_bank & 0x1F) : gb->selected_rom_bank;
+
+    gb->rom_bank_offset = bank * ROM_BANK_SIZE;
+
+    /* ROM bank 0 and the selected ROM bank, when the ROM is in memory.
+     * Banks beyond the end of the ROM are left to gb_rom_read(). */
+    if (gb->rom != NULL) {
+        const uint_fast32_t bank_offset = gb->rom_bank_offset;
+        const uint8_t fits = bank_offset + ROM_BANK_SIZE <= gb->rom_size;
+
+        for (uint_fast8_t i = 0; i < ROM_BANK_SIZE / MEM_PAGE_SIZE; i++) {
+            gb->mem_map.read[(ROM_0_ADDR >> MEM_PAGE_SHIFT) + i] =
+                gb->rom + i * MEM_PAGE_SIZE;
+            gb->mem_map.read[(ROM_N_ADDR >> MEM_PAGE_SHIFT) + i] =
+                fits ? gb->rom + bank_offset + i * MEM_PAGE_SIZE : NULL;
+        }
+    }
+
+    /* Selected cartridge RAM bank, when the RAM is in memory and enabled.
+     * MBC3 RTC registers are left to the slow path. */
+    if (gb->sram != NULL) {
+        /* From the bank number, with the bits the MBC uses, so that banks
+         * beyond the given RAM fail the bounds check below. */
+        const uint_fast32_t bank_offset =
+            (uint_fast32_t)(gb->mbc == 3 ? gb->cart_ram_bank & 0x03 : gb->cart_ram_bank) << 13;
+        uint8_t* sram = NULL;
+
+        if (gb->cart_ram && gb->enable_cart_ram &&
+            !(gb->mbc == 3 && gb->cart_ram_bank >= 0x08) &&
+            bank_offset < gb->sram_size && gb->sram_size - bank_offset >= CRAM_BANK_SIZE)
+            sram = gb->sram + bank_offset;
+
+        gb->mem_map.read[0xA] = sram;
+        gb->mem_map.read[0xB] = sram != NULL ? sram + MEM_PAGE_SIZE : NULL;
+        /* Writes are ignored by cartridges without RAM banks. */
+        gb->mem_map.write[0xA] = gb->num_ram_banks ? sram : NULL;
+        gb->mem_map.write[0xB] = gb->num_ram_banks && sram != NULL ? sram + MEM_PAGE_SIZE : NULL;
+    }
+
+    /* VRAM, through the selected CGB bank. Writes must invalidate the
+     * tile cache. */
+    uint8_t* vram = &gb->vram[VRAM_ADDR - gb->cgb.vramBankOffset];
+    gb->mem_map.read[0x8] = vram;
+    gb->mem_map.read[0x9] = vram + MEM_PAGE_SIZE;
+#if !ENABLE_TILE_CACHE
+    gb->mem_map.write[0x8] = vram;
+    gb->mem_map.write[0x9] = vram + MEM_PAGE_SIZE;
+#endif
+
+    /* WRAM bank 0, switchable bank and echo of bank 0. The echo of the
+     * switchable bank shares its page with OAM and IO. */
+    gb->mem_map.read[0xC] = gb->mem_map.write[0xC] = &gb->wram[0];
+    gb->mem_map.read[0xD] = gb->mem_map.write[0xD] =
+        &gb->wram[WRAM_1_ADDR - gb->cgb.wramBankOffset];
+    gb->mem_map.read[0xE] = gb->mem_map.write[0xE] = &gb->wram[0];
+}
+
+/* Bits of a byte spread to every other bit, see __gb_decode_tile_row(). */
+static const uint16_t TILE_ROW_SPREAD[256] = {
+    0x0000, 0x0001, 0x0004, 0x0005, 0x0010, 0x0011, 0x0014, 0x0015,
+    0x0040, 0x0041, 0x0044, 0x0045, 0x0050, 0x0051, 0x0054, 0x0055,
+    0x0100, 0x0101, 0x0104, 0x0105, 0x0110, 0x0111, 0x0114, 0x0115,
+    0x0140, 0x0141, 0x0144, 0x0145, 0x0150, 0x0151, 0x0154, 0x0155,
+    0x0400, 0x0401, 0x0404, 0x0405, 0x0410, 0x0411, 0x0414, 0x0415,
+    0x0440, 0x0441, 0x0444, 0x0445, 0x0450, 0x0451, 0x0454, 0x0455,
+    0x0500, 0x0501, 0x0504, 0x0505, 0x0510, 0x0511, 0x0514, 0x0515,
+    0x0540, 0x0541, 0x0544, 0x0545, 0x0550, 0x0551, 0x0554, 0x0555,
+    0x1000, 0x1001, 0x1004, 0x1005, 0x1010, 0x1011, 0x1014, 0x1015,
+    0x1040, 0x1041, 0x1044, 0x1045, 0x1050, 0x1051, 0x1054, 0x1055,
+    0x1100, 0x1101, 0x1104, 0x1105, 0x1110, 0x1111, 0x1114, 0x1115,
+    0x1140, 0x1141, 0x1144, 0x1145, 0x1150, 0x1151, 0x1154, 0x1155,
+    0x1400, 0x1401, 0x1404, 0x1405, 0x1410, 0x1411, 0x1414, 0x1415,
+    0x1440, 0x1441, 0x1444, 0x1445, 0x1450, 0x1451, 0x1454, 0x1455,
+    0x1500, 0x1501, 0x1504, 0x1505, 0x1510, 0x1511, 0x1514, 0x1515,
+    0x1540, 0x1541, 0x1544, 0x1545, 0x1550, 0x1551, 0x1554, 0x1555,
+    0x4000, 0x4001, 0x4004, 0x4005, 0x4010, 0x4011, 0x4014, 0x4015,
+    0x4040, 0x4041, 0x4044, 0x4045, 0x4050, 0x4051, 0x4054, 0x4055,
+    0x4100, 0x4101, 0x4104, 0x4105, 0x4110, 0x4111, 0x4114, 0x4115,
+    0x4140, 0x4141, 0x4144, 0x4145, 0x4150, 0x4151, 0x4154, 0x4155,
+    0x4400, 0x4401, 0x4404, 0x4405, 0x4410, 0x4411, 0x4414, 0x4415,
+    0x4440, 0x4441, 0x4444, 0x4445, 0x4450, 0x4451, 0x4454, 0x4455,
+    0x4500, 0x4501, 0x4504, 0x4505, 0x4510, 0x4511, 0x4514, 0x4515,
+    0x4540, 0x4541, 0x4544, 0x4545, 0x4550, 0x4551, 0x4554, 0x4555,
+    0x5000, 0x5001, 0x5004, 0x5005, 0x5010, 0x5011, 0x5014, 0x5015,
+    0x5040, 0x5041, 0x5044, 0x5045, 0x5050, 0x5051, 0x5054, 0x5055,
+    0x5100, 0x5101, 0x5104, 0x5105, 0x5110, 0x5111, 0x5114, 0x5115,
+    0x5140, 0x5141, 0x5144, 0x5145, 0x5150, 0x5151, 0x5154, 0x5155,
+    0x5400, 0x5401, 0x5404, 0x5405, 0x5410, 0x5411, 0x5414, 0x5415,
+    0x5440, 0x5441, 0x5444, 0x5445, 0x5450, 0x5451, 0x5454, 0x5455,
+    0x5500, 0x5501, 0x5504, 0x5505, 0x5510, 0x5511, 0x5514, 0x5515,
+    0x5540, 0x5541, 0x5544, 0x5545, 0x5550, 0x5551, 0x5554, 0x5555,
+};
+
+/**
+ * Internal function used to decode one row of a tile from its two bitplane
+ * bytes. The result holds the 2-bit colour index of each pixel, the
+ * rightmost pixel in the lowest bits.
+ */
+uint_fast16_t __gb_decode_tile_row(const uint8_t lo, const uint8_t hi) {
+    return TILE_ROW_SPREAD[lo] | (TILE_ROW_SPREAD[hi] << 1);
+}
+
+#if ENABLE_TILE_CACHE
+/**
+ * Internal function used to mark the tiles covering len bytes of VRAM from
+ * the given offset as written, and with ENABLE_LINE_SKIP the tile map rows
+ * too. The bytes must be within one VRAM bank.
+ */
+void __gb_invalidate_tiles(struct gb_s* gb, const uint_fast16_t offset, const uint_fast16_t len) {
+    const uint_fast16_t first = (offset & (VRAM_BANK_SIZE - 1)) / VRAM_TILE_SIZE;
+    const uint_fast16_t last = ((offset + len - 1) & (VRAM_BANK_SIZE - 1)) / VRAM_TILE_SIZE;
+    const uint_fast16_t tiles = VRAM_TILE_DATA_SIZE / VRAM_TILE_SIZE;
+
+    if (first < tiles)
+        memset(&gb->tile_dirty[offset / VRAM_BANK_SIZE][first], 1, MIN(last + 1, tiles) - first);
+
+#if ENABLE_LINE_SKIP
+    for (uint_fast16_t tile = first; tile <= last; tile++) {
+        if (tile < tiles)
+            gb->tile_version[offset / VRAM_BANK_SIZE][tile]++;
+        else
+            /* Two tile map rows per tile sized block. */
+            gb->map_version[(tile - tiles) / 2]++;
+    }
+#endif
+}
+#endif
+
+/**
+ * Internal function used to fetch a decoded tile row, given the VRAM offset
+ * of its first byte.
+ */
+uint_fast16_t __gb_tile_row(struct gb_s* gb, const uint_fast16_t offset) {
+#if ENABLE_TILE_CACHE
+    const uint_fast16_t bank = offset / VRAM_BANK_SIZE;
+    const uint_fast16_t row = (offset & (VRAM_BANK_SIZE - 1)) / 2;
+    const uint_fast16_t tile = row / (VRAM_TILE_SIZE / 2);
+
+    if (gb->tile_dirty[bank][tile]) {
+        const uint8_t* data = &gb->vram[offset & ~(VRAM_TILE_SIZE - 1)];
+        uint16_t* rows = &gb->tile_rows[bank][tile * (VRAM_TILE_SIZE / 2)];
+
+        for (uint_fast8_t i = 0; i < VRAM_TILE_SIZE / 2; i++)
+            rows[i] = __gb_decode_tile_row(data[2 * i], data[2 * i + 1]);
+
+        gb->tile_dirty[bank][tile] = 0;
+    }
+
+    return gb->tile_rows[bank][row];
+#else
+    return __gb_decode_tile_row(gb->vram[offset], gb->vram[offset + 1]);
+#endif
+}
+
 /**
  * Internal function used to read bytes.
  */
 uint8_t __gb_read(struct gb_s* gb, const uint_fast16_t addr) {
+    /* Plain memory page. */
+    const uint8_t* page = gb->mem_map.read[addr >> MEM_PAGE_SHIFT];
+
+    if (page != NULL)
+        return page[addr & MEM_PAGE_MASK];
+
     switch (addr >> 12) {
     case 0x0:
 
@@ -565,11 +1078,7 @@ uint8_t __gb_read(struct gb_s* gb, const uint_fast16_t addr) {
     case 0x5:
     case 0x6:
     case 0x7:
-        if (gb->mbc == 1 && gb->cart_mode_select)
-            return gb->gb_rom_read(gb,
-                addr + ((gb->selected_rom_bank & 0x1F) - 1) * ROM_BANK_SIZE);
-        else
-            return gb->gb_rom_read(gb, addr + (gb->selected_rom_bank - 1) * ROM_BANK_SIZE);
+        return gb->gb_rom_read(gb, addr - ROM_N_ADDR + gb->rom_bank_offset);
 
     case 0x8:
     case 0x9:
@@ -612,12 +1121,19 @@ uint8_t __gb_read(struct gb_s* gb, const uint_fast16_t addr) {
 
         if ((addr >= 0xFF10) && (addr <= 0xFF3F)) {
 #if ENABLE_SOUND
+#if ENABLE_IDLE_LOOP_DETECTION
+            gb->idle.dirty = 1;
+#endif
             return audio_read(addr);
 #else
             return 1;
 #endif
         }
 
+        /* Timer, serial and LCD registers must reflect every cycle run
+         * so far. */
+        __gb_sync(gb);
+
         /* IO and Interrupts. */
         switch (addr & 0xFF) {
             /* IO Registers */
@@ -632,9 +1148,16 @@ uint8_t __gb_read(struct gb_s* gb, const uint_fast16_t addr) {
 
             /* Timer Registers */
         case 0x04:
-            return gb->gb_reg.DIV;
+#if ENABLE_IDLE_LOOP_DETECTION
+            gb->idle.dirty = 1;
+#endif
+            return __gb_div(gb);
 
         case 0x05:
+#if ENABLE_IDLE_LOOP_DETECTION
+            gb->idle.dirty = 1;
+#endif
+            __gb_update_tima(gb);
             return gb->gb_reg.TIMA;
 
         case 0x06:
@@ -747,21 +1270,22 @@ uint8_t __gb_read(struct gb_s* gb, const uint_fast16_t addr) {
 }
 
 /**
- * Internal function used to write bytes.
+ * Internal function used to write to the cartridge's memory bank controller.
+ * Only called with a constant mbc, see __gb_write_mbc0() and the like.
  */
-void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
+static GB_ALWAYS_INLINE void __gb_write_mbc(struct gb_s* gb, const uint8_t mbc, const uint_fast16_t addr, const uint8_t val) {
     switch (addr >> 12) {
     case 0x0:
     case 0x1:
-        if (gb->mbc == 2 && addr & 0x10)
+        if (mbc == 2 && addr & 0x10)
             return;
-        else if (gb->mbc > 0 && gb->cart_ram)
+        else if (mbc > 0 && gb->cart_ram)
             gb->enable_cart_ram = ((val & 0x0F) == 0x0A);
 
         return;
 
     case 0x2:
-        if (gb->mbc == 5) {
+        if (mbc == 5) {
             gb->selected_rom_bank = (gb->selected_rom_bank & 0x100) | val;
             gb->selected_rom_bank =
                 gb->selected_rom_bank & gb->num_rom_banks_mask;
@@ -771,26 +1295,26 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
         /* Intentional fall through. */
 
     case 0x3:
-        if (gb->mbc == 1) {
+        if (mbc == 1) {
             //selected_rom_bank = val & 0x7;
             gb->selected_rom_bank = (val & 0x1F) | (gb->selected_rom_bank & 0x60);
 
             if ((gb->selected_rom_bank & 0x1F) == 0x00)
                 gb->selected_rom_bank++;
         }
-        else if (gb->mbc == 2 && addr & 0x10) {
+        else if (mbc == 2 && addr & 0x10) {
             gb->selected_rom_bank = val & 0x0F;
 
             if (!gb->selected_rom_bank)
                 gb->selected_rom_bank++;
         }
-        else if (gb->mbc == 3) {
+        else if (mbc == 3) {
             gb->selected_rom_bank = val & 0x7F;
 
             if (!gb->selected_rom_bank)
                 gb->selected_rom_bank++;
         }
-        else if (gb->mbc == 5)
+        else if (mbc == 5)
             gb->selected_rom_bank = (val & 0x01) << 8 | (gb->selected_rom_bank & 0xFF);
 
         gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
@@ -798,17 +1322,17 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
 
     case 0x4:
     case 0x5:
-        if (gb->mbc == 1) {
+        if (mbc == 1) {
             gb->cart_ram_bank = (val & 3);
             gb->cart_ram_bank_offset = 0xA000 - (gb->cart_ram_bank << 13);
             gb->selected_rom_bank = ((val & 3) << 5) | (gb->selected_rom_bank & 0x1F);
             gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
         }
-        else if (gb->mbc == 3) {
+        else if (mbc == 3) {
             gb->cart_ram_bank = val;
             gb->cart_ram_bank_offset = 0xA000 - ((gb->cart_ram_bank & 3) << 13);
         }
-        else if (gb->mbc == 5) {
+        else if (mbc == 5) {
             gb->cart_ram_bank = (val & 0x0F);
             gb->cart_ram_bank_offset = 0xA000 - (gb->cart_ram_bank << 13);
         }
@@ -818,10 +1342,195 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
     case 0x7:
         gb->cart_mode_select = (val & 1);
         return;
+    }
+}
+
+/**
+ * Internal functions used to write to each type of memory bank controller.
+ * gb_init() selects one of them as gb->mbc_write.
+ */
+void __gb_write_mbc0(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
+    __gb_write_mbc(gb, 0, addr, val);
+}
+
+void __gb_write_mbc1(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
+    __gb_write_mbc(gb, 1, addr, val);
+}
+
+void __gb_write_mbc2(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
+    __gb_write_mbc(gb, 2, addr, val);
+}
+
+void __gb_write_mbc3(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
+    __gb_write_mbc(gb, 3, addr, val);
+}
+
+void __gb_write_mbc5(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
+    __gb_write_mbc(gb, 5, addr, val);
+}
+
+void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val);
+
+/**
+ * Internal function used to split a DMG palette register into the colour of
+ * each of its four indexes.
+ */
+static inline void __gb_unpack_palette(uint8_t palette[4], const uint8_t reg) {
+    for (uint8_t i = 0; i < 4; i++)
+        palette[i] = (reg >> (2 * i)) & 0x03;
+}
+
+#if ENABLE_DEFERRED_LINES
+void __gb_draw_deferred_lines(struct gb_s* gb);
+
+/**
+ * Internal function used before writing to VRAM, OAM or a CGB palette, to
+ * draw the lines waiting to be drawn with what they showed, and the rest of
+ * the frame line by line.
+ */
+static inline void __gb_defer_lines_write(struct gb_s* gb) {
+    if (gb->display.deferred_count != 0) {
+        __gb_draw_deferred_lines(gb);
+        gb->display.deferred_off = 1;
+    }
+}
+#endif
+
+/**
+ * Internal function used to copy a block of memory, as done by CGB DMA.
+ * Runs of plain memory pages are copied in bulk, anything else byte by byte.
+ */
+void __gb_copy(struct gb_s* gb, uint_fast16_t dest, uint_fast32_t src, uint_fast16_t len) {
+#if ENABLE_IDLE_LOOP_DETECTION
+    gb->idle.dirty = 1;
+#endif
+#if ENABLE_DEFERRED_LINES
+    __gb_defer_lines_write(gb);
+#endif
+
+    while (len > 0) {
+        const uint8_t* from = src <= 0xFFFF ? gb->mem_map.read[src >> MEM_PAGE_SHIFT] : NULL;
+        uint8_t* to = gb->mem_map.write[dest >> MEM_PAGE_SHIFT];
+        uint_fast16_t n = 1;
+
+#if ENABLE_TILE_CACHE
+        /* VRAM is not in the write map, tiles are invalidated below. */
+        if ((dest & ~(VRAM_BANK_SIZE - 1)) == VRAM_ADDR)
+            to = &gb->vram[(dest & ~MEM_PAGE_MASK) - gb->cgb.vramBankOffset];
+#endif
+
+        if (from != NULL && to != NULL) {
+            from += src & MEM_PAGE_MASK;
+            to += dest & MEM_PAGE_MASK;
+
+            /* Stop at the end of either page and, for a forward overlap,
+             * before the bytes that have yet to be read. */
+            n = len;
+            if (n > MEM_PAGE_SIZE - (src & MEM_PAGE_MASK))
+                n = MEM_PAGE_SIZE - (src & MEM_PAGE_MASK);
+            if (n > MEM_PAGE_SIZE - (dest & MEM_PAGE_MASK))
+                n = MEM_PAGE_SIZE - (dest & MEM_PAGE_MASK);
+            if (to > from && (uint_fast16_t)(to - from) < n)
+                n = to - from;
+
+            memmove(to, from, n);
+#if ENABLE_TILE_CACHE
+            if ((dest & ~(VRAM_BANK_SIZE - 1)) == VRAM_ADDR)
+                __gb_invalidate_tiles(gb, to - gb->vram, n);
+#endif
+        } else if (src > 0xFFFF) {
+            /* The source does not wrap around the address space. */
+            (gb->gb_error)(gb, GB_INVALID_READ, src);
+            __gb_write(gb, dest, 0xFF);
+        } else {
+            __gb_write(gb, dest, __gb_read(gb, src));
+        }
+
+        src += n;
+        dest += n;
+        len -= n;
+    }
+}
+
+/**
+ * Internal function used to copy a page to OAM, as done by OAM DMA.
+ */
+void __gb_oam_dma(struct gb_s* gb) {
+    const uint_fast16_t src = gb->gb_reg.DMA << 8;
+    const uint8_t* from = gb->mem_map.read[src >> MEM_PAGE_SHIFT];
+
+#if ENABLE_DEFERRED_LINES
+    __gb_defer_lines_write(gb);
+#endif
+#if ENABLE_LCD
+    gb->display.sprites_dirty = 1;
+#endif
+
+    /* The 160 bytes never straddle a page. */
+    if (from != NULL) {
+        memcpy(gb->oam, from + (src & MEM_PAGE_MASK), OAM_SIZE);
+        return;
+    }
+
+    for (uint8_t i = 0; i < OAM_SIZE; i++)
+        gb->oam[i] = __gb_read(gb, src + i);
+}
+
+#if ENABLE_LCD
+/**
+ * Internal function used to convert a CGB palette colour (red in the low
+ * bits) to RGB565 (red in the high bits).
+ */
+uint16_t __gb_rgb555_to_rgb565(const uint16_t c) {
+    return ((c & 0x001F) << 11) | ((c & 0x03E0) << 1) | ((c & 0x7C00) >> 10);
+}
+#endif
+
+/**
+ * Internal function used to write bytes.
+ */
+void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
+#if ENABLE_IDLE_LOOP_DETECTION
+    gb->idle.dirty = 1;
+#endif
+
+    /* Plain RAM page. */
+    uint8_t* page = gb->mem_map.write[addr >> MEM_PAGE_SHIFT];
+
+    if (page != NULL) {
+        page[addr & MEM_PAGE_MASK] = val;
+        return;
+    }
+
+    switch (addr >> 12) {
+    case 0x0:
+    case 0x1:
+    case 0x2:
+    case 0x3:
+    case 0x4:
+    case 0x5:
+    case 0x6:
+    case 0x7:
+        gb->mbc_write(gb, addr, val);
+        __gb_update_mem_map(gb);
+#if ENABLE_BLOCK_CACHE
+        /* Code running from the switchable bank may have switched it out
+         * under the current block: end the run, the next one looks the
+         * block up again. */
+        if (gb->cpu_reg.pc >= ROM_N_ADDR && gb->cpu_reg.pc < VRAM_ADDR)
+            gb->counter.next_event = 0;
+#endif
+        return;
 
     case 0x8:
     case 0x9:
+#if ENABLE_DEFERRED_LINES
+        __gb_defer_lines_write(gb);
+#endif
         gb->vram[addr - gb->cgb.vramBankOffset] = val;
+#if ENABLE_TILE_CACHE
+        __gb_invalidate_tiles(gb, addr - gb->cgb.vramBankOffset, 1);
+#endif
         return;
 
     case 0xA:
@@ -854,7 +1563,13 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
         }
 
         if (addr < UNUSED_ADDR) {
+#if ENABLE_DEFERRED_LINES
+            __gb_defer_lines_write(gb);
+#endif
             gb->oam[addr - OAM_ADDR] = val;
+#if ENABLE_LCD
+            gb->display.sprites_dirty = 1;
+#endif
             return;
         }
 
@@ -873,6 +1588,12 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
 #endif
             return;
         }
+
+        /* Catch up with the cycles run so far, then have the scheduler
+         * look at the new register values once this instruction is done. */
+        __gb_sync(gb);
+        gb->counter.next_event = 0;
+
         uint16_t fixPaletteTemp;
         /* IO and Interrupts. */
         switch (addr & 0xFF) {
@@ -903,11 +1624,13 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
 
             /* Timer Registers */
         case 0x04:
-            gb->gb_reg.DIV = 0x00;
+            gb->counter.div_offset = -(uint8_t)(gb->counter.total / DIV_CYCLES);
             return;
 
         case 0x05:
+            __gb_update_tima(gb);
             gb->gb_reg.TIMA = val;
+            __gb_update_tima(gb);
             return;
 
         case 0x06:
@@ -915,7 +1638,9 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
             return;
 
         case 0x07:
+            __gb_update_tima(gb);
             gb->gb_reg.TAC = val;
+            __gb_update_tima(gb);
             return;
 
             /* Interrupt Flag Register */
@@ -931,6 +1656,11 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
                 gb->lcd_blank = 1;
             }
 
+#if ENABLE_LCD
+            if ((gb->gb_reg.LCDC ^ val) & LCDC_OBJ_SIZE)
+                gb->display.sprites_dirty = 1;
+#endif
+
             gb->gb_reg.LCDC = val;
 
             /* LY fixed to 0 when LCD turned off. */
@@ -970,34 +1700,24 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
         case 0x46:
             gb->gb_reg.DMA = (val % 0xF1);
 
-            for (uint8_t i = 0; i < OAM_SIZE; i++)
-                gb->oam[i] = __gb_read(gb, (gb->gb_reg.DMA << 8) + i);
+            __gb_oam_dma(gb);
 
             return;
 
             /* DMG Palette Registers */
         case 0x47:
             gb->gb_reg.BGP = val;
-            gb->display.bg_palette[0] = (gb->gb_reg.BGP & 0x03);
-            gb->display.bg_palette[1] = (gb->gb_reg.BGP >> 2) & 0x03;
-            gb->display.bg_palette[2] = (gb->gb_reg.BGP >> 4) & 0x03;
-            gb->display.bg_palette[3] = (gb->gb_reg.BGP >> 6) & 0x03;
+            __gb_unpack_palette(gb->display.bg_palette, val);
             return;
 
         case 0x48:
             gb->gb_reg.OBP0 = val;
-            gb->display.sp_palette[0] = (gb->gb_reg.OBP0 & 0x03);
-            gb->display.sp_palette[1] = (gb->gb_reg.OBP0 >> 2) & 0x03;
-            gb->display.sp_palette[2] = (gb->gb_reg.OBP0 >> 4) & 0x03;
-            gb->display.sp_palette[3] = (gb->gb_reg.OBP0 >> 6) & 0x03;
+            __gb_unpack_palette(gb->display.sp_palette, val);
             return;
 
         case 0x49:
             gb->gb_reg.OBP1 = val;
-            gb->display.sp_palette[4] = (gb->gb_reg.OBP1 & 0x03);
-            gb->display.sp_palette[5] = (gb->gb_reg.OBP1 >> 2) & 0x03;
-            gb->display.sp_palette[6] = (gb->gb_reg.OBP1 >> 4) & 0x03;
-            gb->display.sp_palette[7] = (gb->gb_reg.OBP1 >> 6) & 0x03;
+            __gb_unpack_palette(&gb->display.sp_palette[4], val);
             return;
 
             /* Window Position Registers */
@@ -1018,6 +1738,7 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
         case 0x4F:
             gb->cgb.vramBank = val & 0x01;
             if (gb->cgb.cgbMode) gb->cgb.vramBankOffset = VRAM_ADDR - (gb->cgb.vramBank << 13);
+            __gb_update_mem_map(gb);
             return;
 
             /* Turn off boot ROM */
@@ -1046,9 +1767,8 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
             //DMA GBC
             if (gb->cgb.dmaActive) {  // Only transfer if dma is not active (=1) otherwise treat it as a termination
                 if (gb->cgb.cgbMode && (!gb->cgb.dmaMode)) {
-                    for (int i = 0; i < (gb->cgb.dmaSize << 4); i++) {
-                        __gb_write(gb, ((gb->cgb.dmaDest & 0x1FF0) | 0x8000) + i, __gb_read(gb, (gb->cgb.dmaSource & 0xFFF0) + i));
-                    }
+                    __gb_copy(gb, (gb->cgb.dmaDest & 0x1FF0) | 0x8000,
+                        gb->cgb.dmaSource & 0xFFF0, gb->cgb.dmaSize << 4);
                     gb->cgb.dmaSource += (gb->cgb.dmaSize << 4);
                     gb->cgb.dmaDest += (gb->cgb.dmaSize << 4);
                     gb->cgb.dmaSize = 0;
@@ -1070,9 +1790,22 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
 
             /* CGB BG Palette*/
         case 0x69:
+#if ENABLE_LINE_SKIP || ENABLE_DEFERRED_LINES
+            if (gb->cgb.BGPalette[gb->cgb.BGPaletteID & 0x3F] != val) {
+#if ENABLE_DEFERRED_LINES
+                __gb_defer_lines_write(gb);
+#endif
+#if ENABLE_LINE_SKIP
+                gb->display.version++;
+#endif
+            }
+#endif
             gb->cgb.BGPalette[(gb->cgb.BGPaletteID & 0x3F)] = val;
             fixPaletteTemp = (gb->cgb.BGPalette[(gb->cgb.BGPaletteID & 0x3E) + 1] << 8) + (gb->cgb.BGPalette[(gb->cgb.BGPaletteID & 0x3E)]);
             gb->cgb.fixPalette[((gb->cgb.BGPaletteID & 0x3E) >> 1)] = ((fixPaletteTemp & 0x7C00) >> 10) | (fixPaletteTemp & 0x03E0) | ((fixPaletteTemp & 0x001F) << 10);  // swap Red and Blue
+#if ENABLE_LCD
+            if (gb->cgb.cgbMode) gb->display.rgb565[((gb->cgb.BGPaletteID & 0x3E) >> 1)] = __gb_rgb555_to_rgb565(fixPaletteTemp);
+#endif
             if (gb->cgb.BGPaletteInc) gb->cgb.BGPaletteID = (++gb->cgb.BGPaletteID) & 0x3F;
             return;
 
@@ -1084,9 +1817,22 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
 
             /* CGB OAM Palette*/
         case 0x6B:
-            gb->cgb.OAMPalette[(gb->cgb.OAMPaletteID & 0x3F)] = val;
-            fixPaletteTemp = (gb->cgb.OAMPalette[(gb->cgb.OAMPaletteID & 0x3E) + 1] << 8) + (gb->cgb.OAMPalette[(gb->cgb.OAMPaletteID & 0x3E)]);
+#if ENABLE_LINE_SKIP || ENABLE_DEFERRED_LINES
+            if (gb->cgb.OAMPalette[gb->cgb.OAMPaletteID & 0x3F] != val) {
+#if ENABLE_DEFERRED_LINES
+                __gb_defer_lines_write(gb);
+#endif
+#if ENABLE_LINE_SKIP
+                gb->display.version++;
+#endif
+            }
+#endif
+            gb->cgb.OAMPalette[(gb->cgb.OAMPaletteID & 0x3F)] = val;
+            fixPaletteTemp = (gb->cgb.OAMPalette[(gb->cgb.OAMPaletteID & 0x3E) + 1] << 8) + (gb->cgb.OAMPalette[(gb->cgb.OAMPaletteID & 0x3E)]);
             gb->cgb.fixPalette[0x20 + ((gb->cgb.OAMPaletteID & 0x3E) >> 1)] = ((fixPaletteTemp & 0x7C00) >> 10) | (fixPaletteTemp & 0x03E0) | ((fixPaletteTemp & 0x001F) << 10);  // swap Red and Blue
+#if ENABLE_LCD
+            if (gb->cgb.cgbMode) gb->display.rgb565[0x20 + ((gb->cgb.OAMPaletteID & 0x3E) >> 1)] = __gb_rgb555_to_rgb565(fixPaletteTemp);
+#endif
             if (gb->cgb.OAMPaletteInc) gb->cgb.OAMPaletteID = (++gb->cgb.OAMPaletteID) & 0x3F;
             return;
 
@@ -1095,6 +1841,7 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
             gb->cgb.wramBank = val;
             gb->cgb.wramBankOffset = WRAM_1_ADDR - (1 << 12);
             if (gb->cgb.cgbMode && (gb->cgb.wramBank & 7) > 0) gb->cgb.wramBankOffset = WRAM_1_ADDR - ((gb->cgb.wramBank & 7) << 12);
+            __gb_update_mem_map(gb);
             return;
 
             /* Interrupt Enable Register */
@@ -1107,28 +1854,57 @@ void __gb_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val) {
     (gb->gb_error)(gb, GB_INVALID_WRITE, addr);
 }
 
-uint8_t __gb_execute_cb(struct gb_s* gb) {
-    uint8_t inst_cycles;
-    uint8_t cbop = __gb_read(gb, gb->cpu_reg.pc++);
-    uint8_t r = (cbop & 0x7);
-    uint8_t b = (cbop >> 3) & 0x7;
-    uint8_t d = (cbop >> 3) & 0x1;
+/* Access to the flags. SET_Z_RESULT() sets the zero flag from a result and
+ * SET_H_CARRY() sets the half carry flag from bit 4 of the XOR of the
+ * operands and result, which lazy flags keep as they are. FLAGS is the flag
+ * register as pushed on the stack. SET_FLAGS() may evaluate its argument more
+ * than once. */
+#if ENABLE_LAZY_FLAGS
+#define FLAG_Z (gb->cpu_reg.f_lazy.z == 0)
+#define FLAG_N (gb->cpu_reg.f_lazy.n)
+#define FLAG_H ((gb->cpu_reg.f_lazy.h >> 4) & 1)
+#define FLAG_C (gb->cpu_reg.f_lazy.c)
+#define SET_FLAG_Z(v) (gb->cpu_reg.f_lazy.z = !(v))
+#define SET_FLAG_N(v) (gb->cpu_reg.f_lazy.n = (v))
+#define SET_FLAG_H(v) (gb->cpu_reg.f_lazy.h = (v) << 4)
+#define SET_FLAG_C(v) (gb->cpu_reg.f_lazy.c = (v))
+#define SET_Z_RESULT(res) (gb->cpu_reg.f_lazy.z = (uint8_t)(res))
+#define SET_H_CARRY(x) (gb->cpu_reg.f_lazy.h = (uint8_t)(x))
+#define FLAGS (FLAG_Z << 7 | FLAG_N << 6 | FLAG_H << 5 | FLAG_C << 4)
+#define SET_FLAGS(v)                                                    \
+    do {                                                                \
+        SET_FLAG_Z(((v) >> 7) & 1);                                     \
+        SET_FLAG_N(((v) >> 6) & 1);                                     \
+        SET_FLAG_H(((v) >> 5) & 1);                                     \
+        SET_FLAG_C(((v) >> 4) & 1);                                     \
+    } while (0)
+#else
+#define FLAG_Z (gb->cpu_reg.f_bits.z)
+#define FLAG_N (gb->cpu_reg.f_bits.n)
+#define FLAG_H (gb->cpu_reg.f_bits.h)
+#define FLAG_C (gb->cpu_reg.f_bits.c)
+#define SET_FLAG_Z(v) (gb->cpu_reg.f_bits.z = (v))
+#define SET_FLAG_N(v) (gb->cpu_reg.f_bits.n = (v))
+#define SET_FLAG_H(v) (gb->cpu_reg.f_bits.h = (v))
+#define SET_FLAG_C(v) (gb->cpu_reg.f_bits.c = (v))
+#define SET_Z_RESULT(res) (gb->cpu_reg.f_bits.z = ((uint8_t)(res) == 0))
+#define SET_H_CARRY(x) (gb->cpu_reg.f_bits.h = ((x) >> 4) & 1)
+#define FLAGS (gb->cpu_reg.f & 0xF0)
+#define SET_FLAGS(v) (gb->cpu_reg.f = (v) & 0xF0)
+#endif
+
+/**
+ * Internal function used to execute a CB prefixed instruction.
+ * Only called with a constant cbop, see __gb_execute_cb().
+ */
+static GB_ALWAYS_INLINE void __gb_execute_cb_op(struct gb_s* gb, const uint8_t cbop) {
+    const uint8_t r = (cbop & 0x7);
+    const uint8_t b = (cbop >> 3) & 0x7;
+    const uint8_t d = (cbop >> 3) & 0x1;
+    const uint8_t rot = (cbop >> 4) & 0x3;
     uint8_t val;
     uint8_t writeback = 1;
 
-    inst_cycles = 8;
-    /* Add an additional 8 cycles to these sets of instructions. */
-    switch (cbop & 0xC7) {
-    case 0x06:
-    case 0x86:
-    case 0xC6:
-        inst_cycles += 8;
-        break;
-    case 0x46:
-        inst_cycles += 4;
-        break;
-    }
-
     switch (r) {
     case 0:
         val = gb->cpu_reg.b;
@@ -1168,30 +1944,28 @@ uint8_t __gb_execute_cb(struct gb_s* gb) {
     /* TODO: Find out WTF this is doing. */
     switch (cbop >> 6) {
     case 0x0:
-        cbop = (cbop >> 4) & 0x3;
-
-        switch (cbop) {
+        switch (rot) {
         case 0x0:  /* RdC R */
         case 0x1:  /* Rd R */
             if (d) /* RRC R / RR R */
             {
                 uint8_t temp = val;
                 val = (val >> 1);
-                val |= cbop ? (gb->cpu_reg.f_bits.c << 7) : (temp << 7);
-                gb->cpu_reg.f_bits.z = (val == 0x00);
-                gb->cpu_reg.f_bits.n = 0;
-                gb->cpu_reg.f_bits.h = 0;
-                gb->cpu_reg.f_bits.c = (temp & 0x01);
+                val |= rot ? (FLAG_C << 7) : (temp << 7);
+                SET_Z_RESULT(val);
+                SET_FLAG_N(0);
+                SET_FLAG_H(0);
+                SET_FLAG_C(temp & 0x01);
             }
             else /* RLC R / RL R */
             {
                 uint8_t temp = val;
                 val = (val << 1);
-                val |= cbop ? gb->cpu_reg.f_bits.c : (temp >> 7);
-                gb->cpu_reg.f_bits.z = (val == 0x00);
-                gb->cpu_reg.f_bits.n = 0;
-                gb->cpu_reg.f_bits.h = 0;
-                gb->cpu_reg.f_bits.c = (temp >> 7);
+                val |= rot ? FLAG_C : (temp >> 7);
+                SET_Z_RESULT(val);
+                SET_FLAG_N(0);
+                SET_FLAG_H(0);
+                SET_FLAG_C(temp >> 7);
             }
 
             break;
@@ -1199,19 +1973,19 @@ uint8_t __gb_execute_cb(struct gb_s* gb) {
         case 0x2:
             if (d) /* SRA R */
             {
-                gb->cpu_reg.f_bits.c = val & 0x01;
+                SET_FLAG_C(val & 0x01);
                 val = (val >> 1) | (val & 0x80);
-                gb->cpu_reg.f_bits.z = (val == 0x00);
-                gb->cpu_reg.f_bits.n = 0;
-                gb->cpu_reg.f_bits.h = 0;
+                SET_Z_RESULT(val);
+                SET_FLAG_N(0);
+                SET_FLAG_H(0);
             }
             else /* SLA R */
             {
-                gb->cpu_reg.f_bits.c = (val >> 7);
+                SET_FLAG_C(val >> 7);
                 val = val << 1;
-                gb->cpu_reg.f_bits.z = (val == 0x00);
-                gb->cpu_reg.f_bits.n = 0;
-                gb->cpu_reg.f_bits.h = 0;
+                SET_Z_RESULT(val);
+                SET_FLAG_N(0);
+                SET_FLAG_H(0);
             }
 
             break;
@@ -1219,21 +1993,21 @@ uint8_t __gb_execute_cb(struct gb_s* gb) {
         case 0x3:
             if (d) /* SRL R */
             {
-                gb->cpu_reg.f_bits.c = val & 0x01;
+                SET_FLAG_C(val & 0x01);
                 val = val >> 1;
-                gb->cpu_reg.f_bits.z = (val == 0x00);
-                gb->cpu_reg.f_bits.n = 0;
-                gb->cpu_reg.f_bits.h = 0;
+                SET_Z_RESULT(val);
+                SET_FLAG_N(0);
+                SET_FLAG_H(0);
             }
             else /* SWAP R */
             {
                 uint8_t temp = (val >> 4) & 0x0F;
                 temp |= (val << 4) & 0xF0;
                 val = temp;
-                gb->cpu_reg.f_bits.z = (val == 0x00);
-                gb->cpu_reg.f_bits.n = 0;
-                gb->cpu_reg.f_bits.h = 0;
-                gb->cpu_reg.f_bits.c = 0;
+                SET_Z_RESULT(val);
+                SET_FLAG_N(0);
+                SET_FLAG_H(0);
+                SET_FLAG_C(0);
             }
 
             break;
@@ -1242,9 +2016,9 @@ uint8_t __gb_execute_cb(struct gb_s* gb) {
         break;
 
     case 0x1: /* BIT B, R */
-        gb->cpu_reg.f_bits.z = !((val >> b) & 0x1);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
+        SET_Z_RESULT(val & (1 << b));
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
         writeback = 0;
         break;
 
@@ -1292,33 +2066,368 @@ uint8_t __gb_execute_cb(struct gb_s* gb) {
             break;
         }
     }
-    return inst_cycles;
+}
+
+/* Lists the 256 byte values, one call of m() each, for the CB opcodes and
+ * the pixel tables. */
+#define BYTE_ROW(m, hi)                                                 \
+    m(0x##hi##0) m(0x##hi##1) m(0x##hi##2) m(0x##hi##3)                 \
+    m(0x##hi##4) m(0x##hi##5) m(0x##hi##6) m(0x##hi##7)                 \
+    m(0x##hi##8) m(0x##hi##9) m(0x##hi##A) m(0x##hi##B)                 \
+    m(0x##hi##C) m(0x##hi##D) m(0x##hi##E) m(0x##hi##F)
+#define BYTE_VALUES(m)                                                  \
+    BYTE_ROW(m, 0) BYTE_ROW(m, 1) BYTE_ROW(m, 2) BYTE_ROW(m, 3)         \
+    BYTE_ROW(m, 4) BYTE_ROW(m, 5) BYTE_ROW(m, 6) BYTE_ROW(m, 7)         \
+    BYTE_ROW(m, 8) BYTE_ROW(m, 9) BYTE_ROW(m, A) BYTE_ROW(m, B)         \
+    BYTE_ROW(m, C) BYTE_ROW(m, D) BYTE_ROW(m, E) BYTE_ROW(m, F)
+
+/* Internal functions used to execute each CB prefixed instruction. */
+#define CB_HANDLER(op)                                                  \
+    static void __gb_execute_cb_##op(struct gb_s* gb) {                 \
+        __gb_execute_cb_op(gb, op);                                     \
+    }
+BYTE_VALUES(CB_HANDLER)
+#undef CB_HANDLER
+
+/**
+ * Internal function used to execute the CB prefixed instruction cbop, read
+ * after the prefix.
+ * Returns the number of cycles it took, including the prefix.
+ */
+uint8_t __gb_execute_cb(struct gb_s* gb, const uint8_t cbop) {
+#define CB_HANDLER(op) __gb_execute_cb_##op,
+    static void (* const cb_handlers[0x100])(struct gb_s*) =
+    {
+        BYTE_VALUES(CB_HANDLER)
+    };
+#undef CB_HANDLER
+    static const uint8_t cb_cycles[0x100] =
+    {
+        /* *INDENT-OFF* */
+        /*0 1 2  3  4  5  6  7  8  9  A  B  C  D  E  F    */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0x00 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0x10 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0x20 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0x30 */
+        8, 8, 8, 8, 8, 8, 12, 8, 8, 8, 8, 8, 8, 8, 12, 8,          /* 0x40 */
+        8, 8, 8, 8, 8, 8, 12, 8, 8, 8, 8, 8, 8, 8, 12, 8,          /* 0x50 */
+        8, 8, 8, 8, 8, 8, 12, 8, 8, 8, 8, 8, 8, 8, 12, 8,          /* 0x60 */
+        8, 8, 8, 8, 8, 8, 12, 8, 8, 8, 8, 8, 8, 8, 12, 8,          /* 0x70 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0x80 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0x90 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0xA0 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0xB0 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0xC0 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0xD0 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8,          /* 0xE0 */
+        8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8           /* 0xF0 */
+        /* *INDENT-ON* */
+    };
+    cb_handlers[cbop](gb);
+    return cb_cycles[cbop];
 }
 
 #if ENABLE_LCD
-void __gb_draw_line(struct gb_s* gb) {
-    uint8_t pixels[160] = { 0 };
+/* Colour indices of the 4 pixels held in a byte of a decoded tile row, left
+ * to right, then right to left for horizontally flipped tiles. */
+#define TILE_PIXELS_ENTRY(b) { (b) >> 6 & 3, (b) >> 4 & 3, (b) >> 2 & 3, (b) & 3 },
+#define TILE_PIXELS_FLIP_ENTRY(b) { (b) & 3, (b) >> 2 & 3, (b) >> 4 & 3, (b) >> 6 & 3 },
+static const uint8_t TILE_PIXELS[0x100][4] = { BYTE_VALUES(TILE_PIXELS_ENTRY) };
+static const uint8_t TILE_PIXELS_FLIP[0x100][4] = { BYTE_VALUES(TILE_PIXELS_FLIP_ENTRY) };
+#undef TILE_PIXELS_ENTRY
+#undef TILE_PIXELS_FLIP_ENTRY
+
+/* The lowest bit of each byte of a word of pixels, one pixel per byte. */
+#define PIXELS_LSB 0x01010101u
+
+/**
+ * Internal function used to turn a decoded tile row into its 8 colour
+ * indices, one per byte, leftmost pixel first in memory, mirrored when flip
+ * is set. Works on whole words, so the pixels can be coloured and blended 4
+ * at a time.
+ */
+static GB_ALWAYS_INLINE void __gb_tile_pixels(const uint_fast16_t row, const uint8_t flip, uint32_t pixels[2]) {
+    if (flip) {
+        memcpy(&pixels[0], TILE_PIXELS_FLIP[row & 0xFF], 4);
+        memcpy(&pixels[1], TILE_PIXELS_FLIP[row >> 8], 4);
+    }
+    else {
+        memcpy(&pixels[0], TILE_PIXELS[row >> 8], 4);
+        memcpy(&pixels[1], TILE_PIXELS[row & 0xFF], 4);
+    }
+}
+
+/**
+ * Internal function used to prepare __gb_map_pixels() to colour pixels
+ * through the 4 entries of a DMG palette, setting the given bits above them.
+ */
+static GB_ALWAYS_INLINE void __gb_pixel_map(const uint8_t* palette, const uint8_t bits, uint32_t map[4]) {
+    /* Each entry, as the exclusive or of the terms selected by the bits of
+     * its colour index. */
+    map[0] = (palette[0] | bits) * PIXELS_LSB;
+    map[1] = palette[0] ^ palette[1];
+    map[2] = palette[0] ^ palette[2];
+    map[3] = palette[0] ^ palette[1] ^ palette[2] ^ palette[3];
+}
+
+/**
+ * Internal function used to colour a word of pixels through a DMG palette,
+ * prepared by __gb_pixel_map(). The bytes are independent, as none of the
+ * products carries into the next byte.
+ */
+static GB_ALWAYS_INLINE uint32_t __gb_map_pixels(const uint32_t pixels, const uint32_t map[4]) {
+    const uint32_t lo = pixels & PIXELS_LSB;
+    const uint32_t hi = (pixels >> 1) & PIXELS_LSB;
+
+    return map[0] ^ lo * map[1] ^ hi * map[2] ^ (lo & hi) * map[3];
+}
+
+/**
+ * Internal function used to find the pixels of a word whose colour, in
+ * bits 1-0, is not 0. Returns 1 in the byte of each of them, 0 elsewhere.
+ */
+static GB_ALWAYS_INLINE uint32_t __gb_pixels_set(const uint32_t pixels) {
+    return (pixels | pixels >> 1) & PIXELS_LSB;
+}
+
+/**
+ * Internal function used to replace the pixels of dst by those of src where
+ * set, as returned by __gb_pixels_set(), holds 1.
+ */
+static GB_ALWAYS_INLINE uint32_t __gb_blend_pixels(const uint32_t dst, const uint32_t src, const uint32_t set) {
+#if defined(__ARM_FEATURE_DSP)
+    /* Set the GE flag of each byte to replace, then select by them. */
+    uint32_t pixels;
+    __asm__("uadd8 %0, %1, %2\n\t"
+            "sel %0, %3, %4"
+            : "=&r"(pixels)
+            : "r"(set), "r"(0xFFFFFFFFu), "r"(src), "r"(dst)
+            : "cc");
+    return pixels;
+#else
+    const uint32_t mask = set * 0xFF;
+
+    return (dst & ~mask) | (src & mask);
+#endif
+}
+
+/**
+ * Internal function used to fetch the current row of a background or window
+ * tile, given its index and CGB attributes, with the rightmost pixel in the
+ * lowest bits. Horizontal flip is left to __gb_tile_pixels().
+ */
+static GB_ALWAYS_INLINE uint_fast16_t __gb_bg_tile_row(struct gb_s* gb, const uint8_t cgb, const uint8_t idx, const uint8_t idxAtt, const uint8_t py) {
+    uint16_t tile;
+
+    /* Select addressing mode. */
+    if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
+        tile = VRAM_TILES_1 + idx * 0x10;
+    else
+        tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+    if (!cgb)
+        return __gb_tile_row(gb, tile + 2 * py);
+
+    if (idxAtt & 0x08) tile += 0x2000;  //VRAM bank 2
+    if (idxAtt & 0x40) tile += 2 * (7 - py);  //Vertical Flip
+    else tile += 2 * py;
+
+    return __gb_tile_row(gb, tile);
+}
+
+/**
+ * Internal function used to draw background or window tiles from column
+ * x_start to the right edge of the screen, map_x = x + scroll_x being the
+ * X coordinate in the tile map line. Whole tiles are drawn, so up to 7
+ * pixels left of x_start, when it is 0, and right of the screen are drawn
+ * too: pixels and pixelsPrio must have room for them.
+ */
+static GB_ALWAYS_INLINE void __gb_draw_tiles(struct gb_s* gb, const uint8_t cgb, uint8_t* pixels, uint8_t* pixelsPrio, const uint16_t map,
+    const uint8_t scroll_x, const uint8_t py, const uint8_t x_start) {
+    const uint8_t map_x = x_start + scroll_x;
+    int_fast16_t x = x_start - (map_x & 0x07);
+    uint8_t tile_x = map_x >> 3;
+    uint32_t palette[4];
+
+    if (!cgb)
+        __gb_pixel_map(gb->display.bg_palette, LCD_PALETTE_BG, palette);
+
+    for (; x < LCD_WIDTH; x += 8, tile_x = (tile_x + 1) & 0x1F) {
+        const uint8_t idx = gb->vram[map + tile_x];
+        /* CGB attributes, in VRAM bank 1. */
+        const uint8_t idxAtt = cgb ? gb->vram[map + tile_x + 0x2000] : 0;
+        uint32_t tile[2];
+
+        __gb_tile_pixels(__gb_bg_tile_row(gb, cgb, idx, idxAtt, py), idxAtt & 0x20, tile);
+
+        if (cgb) {
+            const uint32_t colour = ((idxAtt & 0x07) << 2) * PIXELS_LSB;
+            const uint32_t prio[2] = { (idxAtt >> 7) * PIXELS_LSB, (idxAtt >> 7) * PIXELS_LSB };
+
+            tile[0] += colour;
+            tile[1] += colour;
+            memcpy(&pixelsPrio[x], prio, sizeof(prio));
+        }
+        else {
+            tile[0] = __gb_map_pixels(tile[0], palette);
+            tile[1] = __gb_map_pixels(tile[1], palette);
+        }
+
+        memcpy(&pixels[x], tile, sizeof(tile));
+    }
+}
+
+/**
+ * Internal function used to list the sprites on each line.
+ */
+void __gb_update_sprite_lines(struct gb_s* gb) {
+    const uint8_t height = gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 16 : 8;
+
+    memset(gb->display.sprite_count, 0, sizeof(gb->display.sprite_count));
+
+    for (uint8_t s = 0; s < NUM_SPRITES; s++) {
+        /* Sprite Y position, 16 pixels above the screen. */
+        const int_fast16_t top = gb->oam[4 * s + 0] - 16;
+
+        for (int_fast16_t line = MAX(top, 0); line < MIN(top + height, LCD_HEIGHT); line++) {
+            if (gb->display.sprite_count[line] < SPRITES_LIST_SIZE)
+                gb->display.sprite_list[line][gb->display.sprite_count[line]++] = s;
+        }
+    }
+
+    gb->display.sprites_dirty = 0;
+}
+
+#if ENABLE_LINE_SKIP
+/* Mixes a value into a line signature, as FNV-1a does with bytes. */
+#define LINE_SIGNATURE_MIX(h, v) ((h) = ((h) ^ (v)) * 0x01000193u)
+
+/**
+ * Internal function used to mix into a line signature the tile map row and
+ * the tiles that __gb_draw_tiles() draws with the same parameters.
+ */
+static GB_ALWAYS_INLINE uint32_t __gb_tiles_signature(struct gb_s* gb, const uint8_t cgb, uint32_t h, const uint16_t map,
+    const uint8_t scroll_x, const uint8_t x_start) {
+    const uint8_t map_x = x_start + scroll_x;
+    int_fast16_t x = x_start - (map_x & 0x07);
+    uint8_t tile_x = map_x >> 3;
+
+    /* Tile indexes and CGB attributes. */
+    LINE_SIGNATURE_MIX(h, gb->map_version[(map - VRAM_BMAP_1) / 0x20]);
+
+    for (; x < LCD_WIDTH; x += 8, tile_x = (tile_x + 1) & 0x1F) {
+        const uint8_t idx = gb->vram[map + tile_x];
+        const uint8_t bank = cgb ? (gb->vram[map + tile_x + 0x2000] >> 3) & 1 : 0;
+        const uint_fast16_t tile = gb->gb_reg.LCDC & LCDC_TILE_SELECT ? idx : 0x80 + ((idx + 0x80) & 0xFF);
+
+        LINE_SIGNATURE_MIX(h, gb->tile_version[bank][tile]);
+    }
+
+    return h;
+}
+
+/**
+ * Internal function used to work out a signature of everything the current
+ * line shows, given whether the window is on it: the registers and palettes
+ * it is drawn with, the tile map rows and tiles it shows and the sprites on
+ * it. The line is the same as when last drawn if its signature is.
+ */
+static GB_ALWAYS_INLINE uint32_t __gb_line_signature(struct gb_s* gb, const uint8_t cgb, const uint8_t window) {
+    uint32_t h = gb->display.version;
+
+    LINE_SIGNATURE_MIX(h, gb->gb_reg.LCDC);
+    LINE_SIGNATURE_MIX(h, gb->gb_reg.BGP | gb->gb_reg.OBP0 << 8 | (uint32_t)gb->gb_reg.OBP1 << 16);
+
+    if (gb->gb_reg.LCDC & LCDC_BG_ENABLE) {
+        const uint8_t bg_y = gb->gb_reg.LY + gb->gb_reg.SCY;
+        const uint16_t bg_map =
+            ((gb->gb_reg.LCDC & LCDC_BG_MAP) ? VRAM_BMAP_2 : VRAM_BMAP_1) + (bg_y >> 3) * 0x20;
+
+        LINE_SIGNATURE_MIX(h, gb->gb_reg.SCX | bg_y << 8);
+        h = __gb_tiles_signature(gb, cgb, h, bg_map, gb->gb_reg.SCX, 0);
+    }
+
+    if (window) {
+        const uint16_t win_line = ((gb->gb_reg.LCDC & LCDC_WINDOW_MAP) ? VRAM_BMAP_2 : VRAM_BMAP_1) +
+            (gb->display.window_clear >> 3) * 0x20;
+
+        LINE_SIGNATURE_MIX(h, gb->gb_reg.WX | gb->display.window_clear << 8);
+        h = __gb_tiles_signature(gb, cgb, h, win_line, 7 - gb->gb_reg.WX, gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7);
+    }
+
+    if (gb->gb_reg.LCDC & LCDC_OBJ_ENABLE) {
+        if (gb->display.sprites_dirty)
+            __gb_update_sprite_lines(gb);
+
+        LINE_SIGNATURE_MIX(h, gb->display.sprite_count[gb->gb_reg.LY]);
+
+        for (uint8_t i = 0; i < gb->display.sprite_count[gb->gb_reg.LY]; i++) {
+            const uint8_t s = gb->display.sprite_list[gb->gb_reg.LY][i];
+            const uint8_t bank = cgb ? (gb->oam[4 * s + 3] & OBJ_BANK) >> 3 : 0;
+            uint32_t attributes;
+
+            memcpy(&attributes, &gb->oam[4 * s], sizeof(attributes));
+            LINE_SIGNATURE_MIX(h, attributes);
+            /* Both tiles of 8x16 sprites. */
+            LINE_SIGNATURE_MIX(h, gb->tile_version[bank][gb->oam[4 * s + 2] & 0xFE]);
+            LINE_SIGNATURE_MIX(h, gb->tile_version[bank][gb->oam[4 * s + 2] | 0x01]);
+        }
+    }
 
+    return h;
+}
+
+#undef LINE_SIGNATURE_MIX
+#endif
+
+/**
+ * Internal function used to draw the current line of a DMG game, or of a CGB
+ * game when cgb is set. Only called with a constant cgb, so that each
+ * variant is compiled without the tests of the other.
+ */
+static GB_ALWAYS_INLINE void __gb_draw_line_mode(struct gb_s* gb, const uint8_t cgb) {
     /* If LCD not initialised by front-end, don't render anything. */
-    if (gb->display.lcd_draw_line == NULL)
+    if (gb->display.lcd_draw_line == NULL && gb->display.lcd_draw_line_rgb565 == NULL)
         return;
 
     if (gb->direct.frame_skip && !gb->display.frame_skip_count)
         return;
 
-    uint8_t pixelsPrio[160] = { 0 };  //do these pixels have priority over OAM?
+    const uint8_t window = gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE && gb->gb_reg.LY >= gb->display.WY && gb->gb_reg.WX <= 166;
+
     /* If interlaced mode is activated, check if we need to draw the current
     * line. */
     if (gb->direct.interlace) {
         if ((gb->display.interlace_count == 0 && (gb->gb_reg.LY & 1) == 0) || (gb->display.interlace_count == 1 && (gb->gb_reg.LY & 1) == 1)) {
             /* Compensate for missing window draw if required. */
-            if (gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE && gb->gb_reg.LY >= gb->display.WY && gb->gb_reg.WX <= 166)
+            if (window)
                 gb->display.window_clear++;
 
             return;
         }
     }
 
+#if ENABLE_LINE_SKIP
+    /* Leave the line on screen if nothing it shows changed. */
+    const uint32_t signature = __gb_line_signature(gb, cgb, window);
+
+    if (signature == gb->display.line_signature[gb->gb_reg.LY]) {
+        if (window)
+            gb->display.window_clear++;
+
+        return;
+    }
+
+    gb->display.line_signature[gb->gb_reg.LY] = signature;
+#endif
+
+    /* The line, with 8 pixels either side where tiles and sprites that
+     * cross the edges of the screen are drawn whole. */
+    uint8_t line[8 + LCD_WIDTH + 8] = { 0 };
+    uint8_t* const pixels = &line[8];
+    uint8_t linePrio[8 + LCD_WIDTH + 8] = { 0 };
+    uint8_t* const pixelsPrio = &linePrio[8];  //do these pixels have priority over OAM?
+
     /* If background is enabled, draw it. */
     if (gb->gb_reg.LCDC & LCDC_BG_ENABLE) {
         /* Calculate current background line to draw. Constant because
@@ -1333,180 +2442,34 @@ void __gb_draw_line(struct gb_s* gb) {
         const uint16_t bg_map =
             ((gb->gb_reg.LCDC & LCDC_BG_MAP) ? VRAM_BMAP_2 : VRAM_BMAP_1) + (bg_y >> 3) * 0x20;
 
-        /* The displays (what the player sees) X coordinate, drawn right
-        * to left. */
-        uint8_t disp_x = LCD_WIDTH - 1;
-
-        /* The X coordinate to begin drawing the background at. */
-        uint8_t bg_x = disp_x + gb->gb_reg.SCX;
-
-        /* Get tile index for current background tile. */
-        uint8_t idx = gb->vram[bg_map + (bg_x >> 3)];
-        uint8_t idxAtt = gb->vram[bg_map + (bg_x >> 3) + 0x2000];
         /* Y coordinate of tile pixel to draw. */
         const uint8_t py = (bg_y & 0x07);
-        /* X coordinate of tile pixel to draw. */
-        uint8_t px = 7 - (bg_x & 0x07);
-
-        uint16_t tile;
-
-        /* Select addressing mode. */
-        if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-            tile = VRAM_TILES_1 + idx * 0x10;
-        else
-            tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-        if (gb->cgb.cgbMode && (idxAtt & 0x08)) tile += 0x2000;  //VRAM bank 2
-        if (gb->cgb.cgbMode && (idxAtt & 0x40)) tile += 2 * (7 - py);
-        if (!gb->cgb.cgbMode || !(idxAtt & 0x40)) tile += 2 * py;
-
-        /* fetch first tile */
-        uint8_t t1, t2;
-        if (gb->cgb.cgbMode && (idxAtt & 0x20)) {  //Horizantal Flip
-            t1 = gb->vram[tile] << px;
-            t2 = gb->vram[tile + 1] << px;
-        }
-        else {
-            t1 = gb->vram[tile] >> px;
-            t2 = gb->vram[tile + 1] >> px;
-        }
-        for (; disp_x != 0xFF; disp_x--) {
-            if (px == 8) {
-                /* fetch next tile */
-                px = 0;
-                bg_x = disp_x + gb->gb_reg.SCX;
-                idx = gb->vram[bg_map + (bg_x >> 3)];
-                idxAtt = gb->vram[bg_map + (bg_x >> 3) + 0x2000];
-
-                if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-                    tile = VRAM_TILES_1 + idx * 0x10;
-                else
-                    tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-                if (gb->cgb.cgbMode && (idxAtt & 0x08)) tile += 0x2000;  //VRAM bank 2
-                if (gb->cgb.cgbMode && (idxAtt & 0x40)) tile += 2 * (7 - py);
-                if (!gb->cgb.cgbMode || !(idxAtt & 0x40)) tile += 2 * py;
-                t1 = gb->vram[tile];
-                t2 = gb->vram[tile + 1];
-            }
 
-            /* copy background */
-            if (gb->cgb.cgbMode && (idxAtt & 0x20)) {  //Horizantal Flip
-                uint8_t c = (((t1 & 0x80) >> 1) | (t2 & 0x80)) >> 6;
-                pixels[disp_x] = ((idxAtt & 0x07) << 2) + c;
-                pixelsPrio[disp_x] = (idxAtt >> 7);
-                t1 = t1 << 1;
-                t2 = t2 << 1;
-            }
-            else {
-                uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-                if (gb->cgb.cgbMode) {
-                    pixels[disp_x] = ((idxAtt & 0x07) << 2) + c;
-                    pixelsPrio[disp_x] = (idxAtt >> 7);
-                }
-                else {
-                    pixels[disp_x] = gb->display.bg_palette[c];
-                    pixels[disp_x] |= LCD_PALETTE_BG;
-                }
-                t1 = t1 >> 1;
-                t2 = t2 >> 1;
-            }
-            px++;
-        }
+        __gb_draw_tiles(gb, cgb, pixels, pixelsPrio, bg_map, gb->gb_reg.SCX, py, 0);
     }
 
     /* draw window */
-    if (gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE && gb->gb_reg.LY >= gb->display.WY && gb->gb_reg.WX <= 166) {
+    if (window) {
         /* Calculate Window Map Address. */
         uint16_t win_line = (gb->gb_reg.LCDC & LCDC_WINDOW_MAP) ? VRAM_BMAP_2 : VRAM_BMAP_1;
         win_line += (gb->display.window_clear >> 3) * 0x20;
 
-        uint8_t disp_x = LCD_WIDTH - 1;
-        uint8_t win_x = disp_x - gb->gb_reg.WX + 7;
-
-        // look up tile
         uint8_t py = gb->display.window_clear & 0x07;
-        uint8_t px = 7 - (win_x & 0x07);
-        uint8_t idx = gb->vram[win_line + (win_x >> 3)];
-        uint8_t idxAtt = gb->vram[win_line + (win_x >> 3) + 0x2000];
-        uint16_t tile;
-
-        if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-            tile = VRAM_TILES_1 + idx * 0x10;
-        else
-            tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-        if (gb->cgb.cgbMode && (idxAtt & 0x08)) tile += 0x2000;  //VRAM bank 2
-        if (gb->cgb.cgbMode && (idxAtt & 0x40)) tile += 2 * (7 - py);
-        if (!gb->cgb.cgbMode || !(idxAtt & 0x40)) tile += 2 * py;
+        uint8_t start = gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7;
 
-        // fetch first tile
-        uint8_t t1, t2;
-        if (gb->cgb.cgbMode && (idxAtt & 0x20)) {  //Horizantal Flip
-            t1 = gb->vram[tile] << px;
-            t2 = gb->vram[tile + 1] << px;
-        }
-        else {
-            t1 = gb->vram[tile] >> px;
-            t2 = gb->vram[tile + 1] >> px;
-        }
-        // loop & copy window
-        uint8_t end = (gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7) - 1;
-
-        for (; disp_x != end; disp_x--) {
-            if (px == 8) {
-                // fetch next tile
-                px = 0;
-                win_x = disp_x - gb->gb_reg.WX + 7;
-                idx = gb->vram[win_line + (win_x >> 3)];
-                idxAtt = gb->vram[win_line + (win_x >> 3) + 0x2000];
-
-                if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-                    tile = VRAM_TILES_1 + idx * 0x10;
-                else
-                    tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-                if (gb->cgb.cgbMode && (idxAtt & 0x08)) tile += 0x2000;  //VRAM bank 2
-                if (gb->cgb.cgbMode && (idxAtt & 0x40)) tile += 2 * (7 - py);
-                if (!gb->cgb.cgbMode || !(idxAtt & 0x40)) tile += 2 * py;
-                t1 = gb->vram[tile];
-                t2 = gb->vram[tile + 1];
-            }
-
-            // copy window
-            if (idxAtt & 0x20) {  //Horizantal Flip
-                uint8_t c = (((t1 & 0x80) >> 1) | (t2 & 0x80)) >> 6;
-                pixels[disp_x] = ((idxAtt & 0x07) << 2) + c;
-                pixelsPrio[disp_x] = (idxAtt >> 7);
-                t1 = t1 << 1;
-                t2 = t2 << 1;
-            }
-            else {
-                uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-                if (gb->cgb.cgbMode) {
-                    pixels[disp_x] = ((idxAtt & 0x07) << 2) + c;
-                    pixelsPrio[disp_x] = (idxAtt >> 7);
-                }
-                else {
-                    pixels[disp_x] = gb->display.bg_palette[c];
-                    pixels[disp_x] |= LCD_PALETTE_BG;
-                }
-                t1 = t1 >> 1;
-                t2 = t2 >> 1;
-            }
-            px++;
-        }
+        __gb_draw_tiles(gb, cgb, pixels, pixelsPrio, win_line, 7 - gb->gb_reg.WX, py, start);
 
         gb->display.window_clear++;  // advance window line
     }
 
     // draw sprites
     if (gb->gb_reg.LCDC & LCDC_OBJ_ENABLE) {
-        uint8_t count = 0;
+        if (gb->display.sprites_dirty)
+            __gb_update_sprite_lines(gb);
 
-        for (uint8_t s = NUM_SPRITES - 1;
-            s != 0xFF /* && count < MAX_SPRITES_LINE */;
-            s--) {
+        /* Lower OAM indexes are drawn last, on top. */
+        for (uint8_t i = gb->display.sprite_count[gb->gb_reg.LY]; i-- > 0;) {
+            const uint8_t s = gb->display.sprite_list[gb->gb_reg.LY][i];
             /* Sprite Y position. */
             uint8_t OY = gb->oam[4 * s + 0];
             /* Sprite X position. */
@@ -1516,15 +2479,6 @@ void __gb_draw_line(struct gb_s* gb) {
             /* Additional attributes. */
             uint8_t OF = gb->oam[4 * s + 3];
 
-            /* If sprite isn't on this line, continue. */
-            if (gb->gb_reg.LY +
-                (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >=
-                OY ||
-                gb->gb_reg.LY + 16 < OY)
-                continue;
-
-            count++;
-
             /* Continue if sprite not visible. */
             if (OX == 0 || OX >= 168)
                 continue;
@@ -1536,69 +2490,799 @@ void __gb_draw_line(struct gb_s* gb) {
                 py = (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 15 : 7) - py;
 
             // fetch the tile
-            uint8_t t1, t2;
-            if (gb->cgb.cgbMode) {
-                t1 = gb->vram[((OF & OBJ_BANK) << 10) + VRAM_TILES_1 + OT * 0x10 + 2 * py];
-                t2 = gb->vram[((OF & OBJ_BANK) << 10) + VRAM_TILES_1 + OT * 0x10 + 2 * py + 1];
+            uint_fast16_t row;
+            if (cgb)
+                row = __gb_tile_row(gb, ((OF & OBJ_BANK) << 10) + VRAM_TILES_1 + OT * 0x10 + 2 * py);
+            else
+                row = __gb_tile_row(gb, VRAM_TILES_1 + OT * 0x10 + 2 * py);
+
+            // handle x flip
+            uint32_t tile[2], colours[2];
+            __gb_tile_pixels(row, OF & OBJ_FLIP_X, tile);
+
+            if (cgb) {
+                const uint32_t colour = (((OF & OBJ_CGB_PALETTE) << 2) + 0x20) * PIXELS_LSB;  // add 0x20 to differentiate from BG
+                colours[0] = tile[0] + colour;
+                colours[1] = tile[1] + colour;
             }
             else {
-                t1 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py];
-                t2 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py + 1];
+                /* Set pixel palette (OBJ0 or OBJ1). */
+                uint32_t palette[4];
+                __gb_pixel_map(&gb->display.sp_palette[OF & OBJ_PALETTE ? 4 : 0], OF & OBJ_PALETTE, palette);
+                colours[0] = __gb_map_pixels(tile[0], palette);
+                colours[1] = __gb_map_pixels(tile[1], palette);
             }
 
-            // handle x flip
-            uint8_t dir, start, end, shift;
+            // copy tile, over the 8 pixels left of OX
+            for (uint8_t i = 0; i < 2; i++) {
+                const int_fast16_t x = OX - 8 + 4 * i;
+                uint32_t bg;
+                memcpy(&bg, &pixels[x], sizeof(bg));
+
+                // check transparency / sprite overlap / background overlap
+                uint32_t set = __gb_pixels_set(tile[i]);
+                if (OF & OBJ_PRIORITY)
+                    set &= ~__gb_pixels_set(bg);
+                if (cgb) {
+                    uint32_t prio;
+                    memcpy(&prio, &pixelsPrio[x], sizeof(prio));
+                    set &= ~(prio & __gb_pixels_set(bg));
+                }
+
+                bg = __gb_blend_pixels(bg, colours[i], set);
+                memcpy(&pixels[x], &bg, sizeof(bg));
+            }
+        }
+    }
+
+    if (gb->display.lcd_draw_line_rgb565 != NULL) {
+        uint16_t colours[LCD_WIDTH];
+
+        for (uint8_t x = 0; x < LCD_WIDTH; x++)
+            colours[x] = gb->display.rgb565[pixels[x]];
+
+        gb->display.lcd_draw_line_rgb565(gb, colours, gb->gb_reg.LY);
+        return;
+    }
+
+    gb->display.lcd_draw_line(gb, pixels, gb->gb_reg.LY);
+}
+
+/**
+ * Internal functions used to draw the current line, specialised for DMG and
+ * CGB games. gb_init() selects one of them as gb->display.draw_line.
+ */
+void __gb_draw_line_dmg(struct gb_s* gb) {
+    __gb_draw_line_mode(gb, 0);
+}
+
+void __gb_draw_line_cgb(struct gb_s* gb) {
+    __gb_draw_line_mode(gb, 1);
+}
+
+#if ENABLE_DEFERRED_LINES
+/**
+ * Internal function used to save the registers a line is drawn with.
+ */
+static void __gb_save_line_regs(const struct gb_s* gb, struct gb_line_regs_s* regs) {
+    regs->LY = gb->gb_reg.LY;
+    regs->LCDC = gb->gb_reg.LCDC;
+    regs->SCX = gb->gb_reg.SCX;
+    regs->SCY = gb->gb_reg.SCY;
+    regs->WX = gb->gb_reg.WX;
+    regs->BGP = gb->gb_reg.BGP;
+    regs->OBP0 = gb->gb_reg.OBP0;
+    regs->OBP1 = gb->gb_reg.OBP1;
+}
+
+/**
+ * Internal function used to load registers saved by __gb_save_line_regs(),
+ * along with the palettes and sprite lists that depend on them.
+ */
+static void __gb_load_line_regs(struct gb_s* gb, const struct gb_line_regs_s* regs) {
+    if ((gb->gb_reg.LCDC ^ regs->LCDC) & LCDC_OBJ_SIZE)
+        gb->display.sprites_dirty = 1;
+
+    if (gb->gb_reg.BGP != regs->BGP)
+        __gb_unpack_palette(gb->display.bg_palette, regs->BGP);
+    if (gb->gb_reg.OBP0 != regs->OBP0)
+        __gb_unpack_palette(gb->display.sp_palette, regs->OBP0);
+    if (gb->gb_reg.OBP1 != regs->OBP1)
+        __gb_unpack_palette(&gb->display.sp_palette[4], regs->OBP1);
+
+    gb->gb_reg.LY = regs->LY;
+    gb->gb_reg.LCDC = regs->LCDC;
+    gb->gb_reg.SCX = regs->SCX;
+    gb->gb_reg.SCY = regs->SCY;
+    gb->gb_reg.WX = regs->WX;
+    gb->gb_reg.BGP = regs->BGP;
+    gb->gb_reg.OBP0 = regs->OBP0;
+    gb->gb_reg.OBP1 = regs->OBP1;
+}
+
+/**
+ * Internal function used to draw the lines waiting to be drawn, each with the
+ * registers it was shown with, then put back the current registers. VRAM,
+ * OAM and CGB palettes are the same as when the lines were shown, as writing
+ * to them draws the lines first.
+ */
+void __gb_draw_deferred_lines(struct gb_s* gb) {
+    struct gb_line_regs_s current;
+
+    if (gb->display.deferred_count == 0)
+        return;
+
+    __gb_save_line_regs(gb, &current);
+
+    for (uint8_t i = 0; i < gb->display.deferred_count; i++) {
+        __gb_load_line_regs(gb, &gb->display.deferred[i]);
+        gb->display.draw_line(gb);
+    }
+
+    __gb_load_line_regs(gb, &current);
+    gb->display.deferred_count = 0;
+}
+#endif
+#endif
+
+/* Timer increment period for each TAC input clock select value. */
+static const uint_fast16_t TAC_CYCLES[4] = { 1024, 16, 64, 256 };
+
+/* Upper bound of a scheduler slice, keeping the cycle counters in range. */
+#define SCHEDULER_MAX_CYCLES 0x4000
+
+/**
+ * Internal function used to read DIV, which is not kept up to date: it only
+ * counts the cycles run, every DIV_CYCLES.
+ */
+uint8_t __gb_div(const struct gb_s* gb) {
+    return (gb->counter.total + gb->counter.pending) / DIV_CYCLES + gb->counter.div_offset;
+}
+
+/**
+ * Internal function used to bring TIMA up to date with the cycles run since
+ * it last was, requesting a timer interrupt on each overflow, and to find
+ * when it next overflows. Must be called before changing TIMA or TAC, and
+ * again after, as TIMA is otherwise only brought up to date on overflow.
+ */
+void __gb_update_tima(struct gb_s* gb) {
+    const uint_fast32_t now = gb->counter.total + gb->counter.pending;
+    const uint_fast16_t period = TAC_CYCLES[gb->gb_reg.tac_rate];
+
+    if (gb->gb_reg.tac_enable) {
+        const uint_fast32_t count = gb->counter.tima_count + (now - gb->counter.tima_time);
+        uint_fast32_t ticks = count / period;
+
+        gb->counter.tima_count = count % period;
+
+        /* On overflow, set TMA to TIMA. */
+        while (ticks >= 0x100u - gb->gb_reg.TIMA) {
+            ticks -= 0x100u - gb->gb_reg.TIMA;
+            gb->gb_reg.TIMA = gb->gb_reg.TMA;
+            gb->gb_reg.IF |= TIMER_INTR;
+        }
+
+        gb->gb_reg.TIMA += ticks;
+    }
+
+    gb->counter.tima_time = now;
+    gb->counter.tima_overflow = (uint_fast32_t)(0x100 - gb->gb_reg.TIMA) * period -
+        gb->counter.tima_count;
+}
+
+/**
+ * Internal function used to advance the LCD by the given number of cycles.
+ * Must not be called with more cycles than __gb_next_event() allows, as at
+ * most one LCD mode change is made per call.
+ */
+void __gb_update_lcd(struct gb_s* gb, const uint_fast16_t cycles) {
+    /* LCD Timing */
+    gb->counter.lcd_count += (cycles >> gb->cgb.doubleSpeed);
+
+    /* New Scanline */
+    if (gb->counter.lcd_count > LCD_LINE_CYCLES) {
+        gb->counter.lcd_count -= LCD_LINE_CYCLES;
+
+        /* LYC Update */
+        if (gb->gb_reg.LY == gb->gb_reg.LYC) {
+            gb->gb_reg.STAT |= STAT_LYC_COINC;
+
+            if (gb->gb_reg.STAT & STAT_LYC_INTR)
+                gb->gb_reg.IF |= LCDC_INTR;
+        }
+        else
+            gb->gb_reg.STAT &= 0xFB;
+
+        /* Next line */
+        gb->gb_reg.LY = (gb->gb_reg.LY + 1) % LCD_VERT_LINES;
+
+        /* VBLANK Start */
+        if (gb->gb_reg.LY == LCD_HEIGHT) {
+            gb->lcd_mode = LCD_VBLANK;
+            gb->gb_frame = 1;
+            gb->gb_reg.IF |= VBLANK_INTR;
+            gb->lcd_blank = 0;
+
+            if (gb->gb_reg.STAT & STAT_MODE_1_INTR)
+                gb->gb_reg.IF |= LCDC_INTR;
+
+#if ENABLE_LCD
+#if ENABLE_DEFERRED_LINES
+            /* Draw the frame, and try drawing the next one in one go
+             * again. */
+            __gb_draw_deferred_lines(gb);
+            gb->display.deferred_off = 0;
+#endif
+
+            /* If frame skip is activated, check if we need to draw
+             * the frame or skip it. */
+            if (gb->direct.frame_skip) {
+                gb->display.frame_skip_count =
+                    !gb->display.frame_skip_count;
+            }
+
+            /* If interlaced is activated, change which lines get
+             * updated. Also, only update lines on frames that are
+             * actually drawn when frame skip is enabled. */
+            if (gb->direct.interlace &&
+                (!gb->direct.frame_skip ||
+                    gb->display.frame_skip_count)) {
+                gb->display.interlace_count =
+                    !gb->display.interlace_count;
+            }
+
+#endif
+        }
+        /* Normal Line */
+        else if (gb->gb_reg.LY < LCD_HEIGHT) {
+            if (gb->gb_reg.LY == 0) {
+                /* Clear Screen */
+                gb->display.WY = gb->gb_reg.WY;
+                gb->display.window_clear = 0;
+            }
+
+            gb->lcd_mode = LCD_HBLANK;
+
+            //DMA GBC
+            if (gb->cgb.cgbMode && (!gb->cgb.dmaActive) && gb->cgb.dmaMode) {
+                __gb_copy(gb, (gb->cgb.dmaDest & 0x1FF0) | 0x8000,
+                    gb->cgb.dmaSource & 0xFFF0, 0x10);
+                gb->cgb.dmaSource += 0x10;
+                gb->cgb.dmaDest += 0x10;
+                if (!(--gb->cgb.dmaSize)) gb->cgb.dmaActive = 1;
+            }
+
+            if (gb->gb_reg.STAT & STAT_MODE_0_INTR)
+                gb->gb_reg.IF |= LCDC_INTR;
+        }
+    }
+    /* OAM access */
+    else if (gb->lcd_mode == LCD_HBLANK && gb->counter.lcd_count >= LCD_MODE_2_CYCLES) {
+        gb->lcd_mode = LCD_SEARCH_OAM;
+
+        if (gb->gb_reg.STAT & STAT_MODE_2_INTR)
+            gb->gb_reg.IF |= LCDC_INTR;
+    }
+    /* Update LCD */
+    else if (gb->lcd_mode == LCD_SEARCH_OAM && gb->counter.lcd_count >= LCD_MODE_3_CYCLES) {
+        gb->lcd_mode = LCD_TRANSFER;
+#if ENABLE_LCD
+        if (!gb->lcd_blank) {
+#if ENABLE_DEFERRED_LINES
+            /* Draw the line with the rest of the frame at VBlank. */
+            if (!gb->display.deferred_off) {
+                __gb_save_line_regs(gb, &gb->display.deferred[gb->display.deferred_count++]);
+                return;
+            }
+#endif
+            gb->display.draw_line(gb);
+        }
+#endif
+    }
+}
+
+
+/**
+ * Internal function used to find how many CPU cycles may run before the
+ * timers, serial port or LCD next change state in a way the CPU can observe
+ * without reading their registers (interrupt request, LCD mode change).
+ */
+uint_fast16_t __gb_next_event(struct gb_s* gb) {
+    uint_fast16_t next = SCHEDULER_MAX_CYCLES;
+
+    /* Serial transfer completion. */
+    if (gb->gb_reg.SC & SERIAL_SC_TX_START) {
+        uint_fast16_t serial = SERIAL_CYCLES > gb->counter.serial_count ?
+            SERIAL_CYCLES - gb->counter.serial_count : 0;
+        next = MIN(next, serial);
+    }
+
+    /* TIMA overflow. */
+    if (gb->gb_reg.tac_enable) {
+        const uint_fast32_t elapsed = gb->counter.total - gb->counter.tima_time;
+        const uint_fast32_t tima = gb->counter.tima_overflow > elapsed ?
+            gb->counter.tima_overflow - elapsed : 0;
+        next = MIN(next, tima);
+    }
+
+    /* LCD mode change or new scanline. */
+    if (gb->gb_reg.LCDC & LCDC_ENABLE) {
+        uint_fast16_t target;
+
+        if (gb->lcd_mode == LCD_HBLANK && gb->counter.lcd_count < LCD_MODE_2_CYCLES)
+            target = LCD_MODE_2_CYCLES;
+        else if (gb->lcd_mode == LCD_SEARCH_OAM && gb->counter.lcd_count < LCD_MODE_3_CYCLES)
+            target = LCD_MODE_3_CYCLES;
+        else
+            target = LCD_LINE_CYCLES + 1;
+
+        target = target > gb->counter.lcd_count ?
+            (target - gb->counter.lcd_count) << gb->cgb.doubleSpeed : 0;
+        next = MIN(next, target);
+    }
+
+    return next;
+}
+
+/**
+ * Internal function used to bring the timers, serial port and LCD up to date
+ * with the cycles run by the CPU since the last call, and to schedule the
+ * next event.
+ */
+void __gb_sync(struct gb_s* gb) {
+    const uint_fast16_t cycles = gb->counter.pending;
+
+    if (cycles == 0)
+        return;
+
+    gb->counter.pending = 0;
+    gb->counter.total += cycles;
+
+    /* Check serial transmission. */
+    if (gb->gb_reg.SC & SERIAL_SC_TX_START) {
+        /* If new transfer, call TX function. */
+        if (gb->counter.serial_count == 0 && gb->gb_serial_tx != NULL)
+            (gb->gb_serial_tx)(gb, gb->gb_reg.SB);
+
+        gb->counter.serial_count += cycles;
+
+        /* If it's time to receive byte, call RX function. */
+        if (gb->counter.serial_count >= SERIAL_CYCLES) {
+            /* If RX can be done, do it. */
+            /* If RX failed, do not change SB if using external
+             * clock, or set to 0xFF if using internal clock. */
+            uint8_t rx;
+
+            if (gb->gb_serial_rx != NULL &&
+                (gb->gb_serial_rx(gb, &rx) ==
+                    GB_SERIAL_RX_SUCCESS)) {
+                gb->gb_reg.SB = rx;
+
+                /* Inform game of serial TX/RX completion. */
+                gb->gb_reg.SC &= 0x01;
+                gb->gb_reg.IF |= SERIAL_INTR;
+            }
+            else if (gb->gb_reg.SC & SERIAL_SC_CLOCK_SRC) {
+                /* If using internal clock, and console is not
+                 * attached to any external peripheral, shifted
+                 * bits are replaced with logic 1. */
+                gb->gb_reg.SB = 0xFF;
+
+                /* Inform game of serial TX/RX completion. */
+                gb->gb_reg.SC &= 0x01;
+                gb->gb_reg.IF |= SERIAL_INTR;
+            }
+            else {
+                /* If using external clock, and console is not
+                 * attached to any external peripheral, bits are
+                 * not shifted, so SB is not modified. */
+            }
+
+            gb->counter.serial_count = 0;
+        }
+    }
+
+    /* TIMA register timing, only brought up to date on overflow. */
+    if (gb->gb_reg.tac_enable &&
+        gb->counter.total - gb->counter.tima_time >= gb->counter.tima_overflow)
+        __gb_update_tima(gb);
+
+    /* TODO Check behaviour of LCD during LCD power off state. */
+    /* If LCD is off, don't update LCD state. */
+    if (gb->gb_reg.LCDC & LCDC_ENABLE)
+        __gb_update_lcd(gb, cycles);
+
+    gb->counter.next_event = __gb_next_event(gb);
+}
+
+/**
+ * Internal function used to detect idle loops. Called after a taken jump,
+ * with the address following the jump instruction and the cycles it took.
+ *
+ * If the jump closes a short loop whose previous iteration left the CPU
+ * registers unchanged, wrote nothing to memory, read neither DIV nor TIMA and
+ * saw no peripheral event, every following iteration is identical until the
+ * next peripheral event changes what the loop reads. Returns the cycles of the
+ * whole iterations that fit before that event, so they can be skipped.
+ */
+uint_fast16_t __gb_idle_loop(struct gb_s* gb, const uint_fast16_t end,
+    const uint_fast16_t inst_cycles) {
+#if ENABLE_IDLE_LOOP_DETECTION
+    const uint_fast16_t target = gb->cpu_reg.pc;
+    const uint_fast32_t now = gb->counter.total + gb->counter.pending;
+    uint_fast16_t skip = 0;
+
+    /* Only consider short backward jumps. */
+    if (target >= end || end - target > IDLE_LOOP_MAX_BYTES)
+        return 0;
+
+    if (!gb->idle.dirty && gb->idle.pc == target &&
+        gb->idle.af == gb->cpu_reg.af && gb->idle.bc == gb->cpu_reg.bc &&
+        gb->idle.de == gb->cpu_reg.de && gb->idle.hl == gb->cpu_reg.hl &&
+        gb->idle.sp == gb->cpu_reg.sp && gb->idle.ime == gb->gb_ime
+#if ENABLE_LAZY_FLAGS
+        && gb->idle.f_lazy == gb->cpu_reg.f_lazy.state
+#endif
+        ) {
+        const uint_fast32_t length = now - gb->idle.cycles;
+        const uint_fast16_t done = gb->counter.pending + inst_cycles;
+
+        /* Stop short of the event, so that it is processed at the end of
+         * the same instruction as without skipping. */
+        if (gb->counter.next_event > done) {
+            skip = (gb->counter.next_event - done - 1) / length * length;
+
+            if (skip) {
+                gb->idle.hits++;
+                gb->idle.skipped_cycles += skip;
+            }
+        }
+    }
+    else {
+        gb->idle.pc = target;
+        gb->idle.af = gb->cpu_reg.af;
+#if ENABLE_LAZY_FLAGS
+        gb->idle.f_lazy = gb->cpu_reg.f_lazy.state;
+#endif
+        gb->idle.bc = gb->cpu_reg.bc;
+        gb->idle.de = gb->cpu_reg.de;
+        gb->idle.hl = gb->cpu_reg.hl;
+        gb->idle.sp = gb->cpu_reg.sp;
+        gb->idle.ime = gb->gb_ime;
+    }
+
+    gb->idle.cycles = now + skip;
+    gb->idle.dirty = 0;
+    return skip;
+#else
+    return 0;
+#endif
+}
+
+#if ENABLE_BLOCK_CACHE
+/**
+ * Internal function used to decode the block of ROM code starting at pc,
+ * found at addr in the ROM, with the labels and cycle counts of
+ * __gb_run_cpu(). The block stops before an invalid opcode, and at the end of
+ * the ROM bank, since the next one may be switched.
+ */
+static void __gb_decode_block(struct gb_s* gb, struct gb_block_s* block, const uint_fast32_t addr,
+    uint_fast16_t pc, const void* const* labels, const uint8_t* cycles) {
+    /* Length of the instructions, 0 for the ones ending a block: anything
+     * that can jump, and the instructions followed by an interrupt check. */
+    static const uint8_t op_length[0x100] =
+    {
+        /* *INDENT-OFF* */
+        /*0 1 2 3 4 5 6 7 8 9 A B C D E F    */
+        1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, /* 0x00 */
+        0, 3, 1, 1, 1, 1, 2, 1, 0, 1, 1, 1, 1, 1, 2, 1, /* 0x10 */
+        0, 3, 1, 1, 1, 1, 2, 1, 0, 1, 1, 1, 1, 1, 2, 1, /* 0x20 */
+        0, 3, 1, 1, 1, 1, 2, 1, 0, 1, 1, 1, 1, 1, 2, 1, /* 0x30 */
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x40 */
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x50 */
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x60 */
+        1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x70 */
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x80 */
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x90 */
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0xA0 */
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0xB0 */
+        0, 1, 0, 0, 0, 1, 2, 0, 0, 0, 0, 2, 0, 0, 2, 0, /* 0xC0 */
+        0, 1, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 2, 0, /* 0xD0 */
+        2, 1, 1, 0, 0, 1, 2, 0, 2, 0, 3, 0, 0, 0, 2, 0, /* 0xE0 */
+        2, 1, 1, 1, 0, 1, 2, 0, 2, 1, 3, 0, 0, 0, 2, 0  /* 0xF0 */
+        /* *INDENT-ON* */
+    };
+    const uint_fast16_t region = pc >> 14;
+    const uint_fast16_t end = pc < ROM_N_ADDR ? ROM_N_ADDR : VRAM_ADDR;
+    uint_fast8_t count = 0;
+
+    while (count < BLOCK_CACHE_OPS && pc < end) {
+        const uint8_t opcode = __gb_read(gb, pc);
+
+        /* Invalid opcodes are left to the normal path. */
+        if (cycles[opcode] == 0)
+            break;
+
+        block->ops[count].label = labels[opcode];
+        block->ops[count].cycles = cycles[opcode];
+        count++;
+
+        /* Follow unconditional jumps that stay in the same bank. */
+        if (opcode == 0x18 || opcode == 0xC3) {
+            const uint_fast16_t target = opcode == 0x18 ?
+                (uint16_t)(pc + 2 + (int8_t)__gb_read(gb, pc + 1)) :
+                __gb_read(gb, pc + 1) | __gb_read(gb, pc + 2) << 8;
+
+            if (target >> 14 != region)
+                break;
+
+            pc = target;
+            continue;
+        }
+
+        if (op_length[opcode] == 0)
+            break;
+
+        pc += op_length[opcode];
+    }
+
+    block->addr = addr;
+    block->count = count;
+}
+
+/**
+ * Internal function used to find the block of ROM code starting at pc in the
+ * block cache, decoding it if it is not there. The blocks are keyed by their
+ * address in the ROM, so that each bank has its own. Returns NULL if there is
+ * no block at pc, as for an invalid opcode.
+ */
+static GB_ALWAYS_INLINE const struct gb_block_s* __gb_find_block(struct gb_s* gb, const uint_fast16_t pc,
+    const void* const* labels, const uint8_t* cycles) {
+    const uint_fast32_t addr = pc < ROM_N_ADDR ? pc : pc - ROM_N_ADDR + gb->rom_bank_offset;
+    struct gb_block_s* block = &gb->block_cache.blocks[(addr ^ addr >> 14) & (BLOCK_CACHE_SIZE - 1)];
+
+    if (block->addr == addr) {
+        gb->block_cache.hits++;
+    }
+    else {
+        gb->block_cache.misses++;
+        __gb_decode_block(gb, block, addr, pc, labels, cycles);
+    }
+
+    return block->count ? block : NULL;
+}
+
+/**
+ * Internal function used to empty the block cache.
+ */
+static void __gb_flush_blocks(struct gb_s* gb) {
+    for (uint_fast16_t i = 0; i < BLOCK_CACHE_SIZE; i++)
+        gb->block_cache.blocks[i].addr = BLOCK_NONE;
+}
+#endif
+
+/**
+ * Internal functions used by __gb_run_cpu() to access memory. Mapped pages
+ * are accessed directly. Anything else goes through __gb_read() or
+ * __gb_write(), which may call the front-end or catch up with the pending
+ * cycles, so the registers and cycle counts the CPU keeps in local variables
+ * are written back to gb before, and the cycle counts read back after.
+ */
+static GB_ALWAYS_INLINE uint8_t __gb_run_read(struct gb_s* gb, const uint_fast16_t addr,
+    const uint16_t* pc, const uint16_t* sp, uint_fast16_t* pending, uint_fast16_t* next_event) {
+    const uint8_t* page = gb->mem_map.read[addr >> MEM_PAGE_SHIFT];
+    uint8_t val;
+
+    if (page != NULL)
+        return page[addr & MEM_PAGE_MASK];
+
+    gb->cpu_reg.pc = *pc;
+    gb->cpu_reg.sp = *sp;
+    gb->counter.pending = *pending;
+    val = __gb_read(gb, addr);
+    *pending = gb->counter.pending;
+    *next_event = gb->counter.next_event;
+    return val;
+}
+
+static GB_ALWAYS_INLINE void __gb_run_write(struct gb_s* gb, const uint_fast16_t addr, const uint8_t val,
+    const uint16_t* pc, const uint16_t* sp, uint_fast16_t* pending, uint_fast16_t* next_event,
+    const uint8_t** fetch, uint_fast32_t* fetch_pc) {
+    uint8_t* page = gb->mem_map.write[addr >> MEM_PAGE_SHIFT];
+
+    if (page != NULL) {
+#if ENABLE_IDLE_LOOP_DETECTION
+        gb->idle.dirty = 1;
+#endif
+        page[addr & MEM_PAGE_MASK] = val;
+        return;
+    }
+
+    gb->cpu_reg.pc = *pc;
+    gb->cpu_reg.sp = *sp;
+    gb->counter.pending = *pending;
+    __gb_write(gb, addr, val);
+    *pending = gb->counter.pending;
+    *next_event = gb->counter.next_event;
+
+    /* The write may have switched a bank: drop the fetch window. */
+    *fetch = NULL;
+    *fetch_pc = FETCH_NONE;
+}
+
+/**
+ * Internal functions used by __gb_run_cpu() to fetch opcodes and immediate
+ * operands at pc. Within the fetch window, see FETCH_UPDATE(), they are read
+ * straight from the page of pc, a 16-bit operand with a single load on
+ * targets allowing unaligned ones.
+ */
+static GB_ALWAYS_INLINE uint8_t __gb_run_imm8(struct gb_s* gb, const uint8_t* fetch,
+    uint16_t* pc, const uint16_t* sp, uint_fast16_t* pending, uint_fast16_t* next_event) {
+    const uint16_t addr = (*pc)++;
 
-            if (OF & OBJ_FLIP_X) {
-                dir = 1;
-                start = (OX < 8 ? 0 : OX - 8);
-                end = MIN(OX, LCD_WIDTH);
-                shift = 8 - OX + start;
-            }
-            else {
-                dir = -1;
-                start = MIN(OX, LCD_WIDTH) - 1;
-                end = (OX < 8 ? 0 : OX - 8) - 1;
-                shift = OX - (start + 1);
-            }
+    if (fetch != NULL)
+        return fetch[addr & MEM_PAGE_MASK];
 
-            // copy tile
-            t1 >>= shift;
-            t2 >>= shift;
+    return __gb_run_read(gb, addr, pc, sp, pending, next_event);
+}
 
-            for (uint8_t disp_x = start; disp_x != end; disp_x += dir) {
-                uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-                // check transparency / sprite overlap / background overlap
-                if (gb->cgb.cgbMode && (c && !(pixelsPrio[disp_x] && (pixels[disp_x] & 0x3)) && !((OF & OBJ_PRIORITY) && (pixels[disp_x] & 0x3)))) {
-                    /* Set pixel colour. */
-                    pixels[disp_x] = ((OF & OBJ_CGB_PALETTE) << 2) + c + 0x20;  // add 0x20 to differentiate from BG
-                }
-                else if (c && !(OF & OBJ_PRIORITY && pixels[disp_x] & 0x3)) {
-                    /* Set pixel colour. */
-                    pixels[disp_x] = (OF & OBJ_PALETTE)
-                        ? gb->display.sp_palette[c + 4]
-                        : gb->display.sp_palette[c];
-                    /* Set pixel palette (OBJ0 or OBJ1). */
-                    pixels[disp_x] |= (OF & OBJ_PALETTE);
-                    /* Deselect BG palette. */
-                    pixels[disp_x] &= ~LCD_PALETTE_BG;
-                }
+static GB_ALWAYS_INLINE uint16_t __gb_run_imm16(struct gb_s* gb, const uint8_t* fetch,
+    uint16_t* pc, const uint16_t* sp, uint_fast16_t* pending, uint_fast16_t* next_event) {
+    uint16_t val;
 
-                t1 = t1 >> 1;
-                t2 = t2 >> 1;
-            }
-        }
+    if (fetch != NULL) {
+        const uint8_t* p = &fetch[*pc & MEM_PAGE_MASK];
+        *pc += 2;
+        return p[0] | p[1] << 8;
     }
 
-    gb->display.lcd_draw_line(gb, pixels, gb->gb_reg.LY);
+    val = __gb_run_imm8(gb, NULL, pc, sp, pending, next_event);
+    return val | __gb_run_imm8(gb, NULL, pc, sp, pending, next_event) << 8;
 }
+
+/* State kept in local variables by __gb_run_cpu(). CPU_SAVE() writes it back
+ * to gb for functions that use it, and CPU_LOAD() reads it again after
+ * functions that may change it. */
+#define CPU_SAVE()                                                      \
+    do {                                                                \
+        gb->cpu_reg.pc = pc;                                            \
+        gb->cpu_reg.sp = sp;                                            \
+        gb->counter.pending = pending;                                  \
+    } while (0)
+#define CPU_LOAD()                                                      \
+    do {                                                                \
+        pc = gb->cpu_reg.pc;                                            \
+        sp = gb->cpu_reg.sp;                                            \
+        pending = gb->counter.pending;                                  \
+        next_event = gb->counter.next_event;                            \
+        fetch = NULL;                                                   \
+        fetch_pc = FETCH_NONE;                                          \
+    } while (0)
+#define READ(addr) __gb_run_read(gb, (addr), &pc, &sp, &pending, &next_event)
+#define WRITE(addr, val) __gb_run_write(gb, (addr), (val), &pc, &sp, &pending, &next_event, &fetch, &fetch_pc)
+#define IMM8() __gb_run_imm8(gb, fetch, &pc, &sp, &pending, &next_event)
+#define IMM16() __gb_run_imm16(gb, fetch, &pc, &sp, &pending, &next_event)
+
+/* Instructions are fetched from the fetch window, the mapped page of pc
+ * pointed to by fetch, starting at fetch_pc, as long as the longest
+ * instruction fits in it. FETCH_UPDATE(), run before each instruction, only
+ * looks the page up again once pc has left the window, by a jump, call,
+ * return or interrupt, or by running past its end. Writes through __gb_write()
+ * drop the window, as may CPU_LOAD(). fetch is NULL for pages that are not
+ * mapped, and near the end of a page. */
+#define FETCH_UPDATE()                                                  \
+    do {                                                                \
+        if ((uint_fast32_t)(pc - fetch_pc) > MEM_PAGE_SIZE - 3) {       \
+            fetch = (pc & MEM_PAGE_MASK) <= MEM_PAGE_SIZE - 3 ?         \
+                gb->mem_map.read[pc >> MEM_PAGE_SHIFT] : NULL;          \
+            fetch_pc = fetch != NULL ?                                  \
+                (uint_fast32_t)(pc & ~MEM_PAGE_MASK) : FETCH_NONE;      \
+        }                                                               \
+    } while (0)
+
+/* Reads the opcode of the next instruction, counting the pair it makes with
+ * the current one when profiling. */
+#if ENABLE_OP_PROFILE
+#define OP_FETCH_NEXT()                                             \
+    do {                                                            \
+        const uint8_t first = opcode;                               \
+        opcode = IMM8();                                            \
+        gb->op_profile.pairs[first][opcode]++;                      \
+    } while (0)
+#else
+#define OP_FETCH_NEXT() (opcode = IMM8())
+#endif
+
+/* Opcode dispatch for __gb_run_cpu(). With computed gotos, OP_NEXT ends an
+ * instruction by going straight to the next one without checking interrupts:
+ * IF and IE only change on peripheral events and IO writes, which both end the
+ * run. OP_NEXT_INTR ends the instructions that can otherwise let an interrupt
+ * through (HALT, RETI and EI), going through the check first. */
+#if ENABLE_COMPUTED_GOTO
+#define OP_DISPATCH(op) goto *op_labels[op];
+#define OP(op) op_##op
+#define OP_INVALID op_invalid
+#if ENABLE_BLOCK_CACHE
+/* Go on with the next instruction of the block, or look up the next block. */
+#define OP_NEXT                                                     \
+    do {                                                            \
+        if (pending + inst_cycles >= next_event)                    \
+            goto end_instruction;                                   \
+        pending += inst_cycles;                                     \
+        if (op == op_end)                                           \
+            goto next_block;                                        \
+        FETCH_UPDATE();                                             \
+        pc++;                                                       \
+        inst_cycles = op->cycles;                                   \
+        goto *(op++)->label;                                        \
+    } while (0)
+#else
+#define OP_NEXT                                                     \
+    do {                                                            \
+        if (pending + inst_cycles >= next_event)                    \
+            goto end_instruction;                                   \
+        pending += inst_cycles;                                     \
+        FETCH_UPDATE();                                             \
+        OP_FETCH_NEXT();                                            \
+        inst_cycles = op_cycles[opcode];                            \
+        goto *op_labels[opcode];                                    \
+    } while (0)
+#endif
+#define OP_NEXT_INTR goto end_instruction
+#if ENABLE_OP_PAIRS && !ENABLE_BLOCK_CACHE
+/* OP_NEXT for an instruction usually followed by the opcode second, which
+ * is then reached with a direct jump, with its cycles known. The pending
+ * cycles are still checked in between, as interrupts may have to be taken
+ * there. */
+#define OP_NEXT_PAIR(second)                                        \
+    do {                                                            \
+        if (pending + inst_cycles >= next_event)                    \
+            goto end_instruction;                                   \
+        pending += inst_cycles;                                     \
+        FETCH_UPDATE();                                             \
+        OP_FETCH_NEXT();                                            \
+        if (opcode == (second)) {                                   \
+            inst_cycles = op_cycles[second];                        \
+            goto OP(second);                                        \
+        }                                                           \
+        inst_cycles = op_cycles[opcode];                            \
+        goto *op_labels[opcode];                                    \
+    } while (0)
+#else
+#define OP_NEXT_PAIR(second) OP_NEXT
+#endif
+#else
+#define OP_DISPATCH(op) switch (op)
+#define OP(op) case op
+#define OP_INVALID default
+#define OP_NEXT break
+#define OP_NEXT_INTR break
+#define OP_NEXT_PAIR(second) OP_NEXT
 #endif
 
 /**
- * Internal function used to step the CPU.
+ * Internal function used to run the CPU.
+ * Executes instructions until the next peripheral event is due, adding their
+ * cycles to the pending cycles. Timers, serial and LCD are not updated here;
+ * see __gb_sync(). PC, SP and the cycle counts are kept in local variables
+ * meanwhile, so that the compiler can keep them in registers.
  */
-void __gb_step_cpu(struct gb_s* gb) {
-    uint8_t opcode, inst_cycles;
+void __gb_run_cpu(struct gb_s* gb) {
+    uint16_t pc = gb->cpu_reg.pc;
+    uint16_t sp = gb->cpu_reg.sp;
+    uint_fast16_t pending = gb->counter.pending;
+    uint_fast16_t next_event = gb->counter.next_event;
+    const uint8_t* fetch = NULL;
+    uint_fast32_t fetch_pc = FETCH_NONE;
+    uint8_t opcode;
+    uint_fast16_t inst_cycles;
+#if ENABLE_BLOCK_CACHE
+    /* Next instruction of the current block, and end of the block. */
+    const struct gb_block_s* block;
+    const struct gb_block_op_s* op = NULL;
+    const struct gb_block_op_s* op_end = NULL;
+    uint_fast32_t instructions = 0;
+#endif
     static const uint8_t op_cycles[0x100] =
     {
         /* *INDENT-OFF* */
@@ -1621,7 +3305,47 @@ void __gb_step_cpu(struct gb_s* gb) {
         12, 12, 8, 4, 0, 16, 8, 16, 12, 8, 16, 4, 0, 0, 8, 16      /* 0xF0 */
         /* *INDENT-ON* */
     };
+#if ENABLE_COMPUTED_GOTO
+    static const void* const op_labels[0x100] =
+    {
+        /* *INDENT-OFF* */
+        &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+        &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+        &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+        &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+        &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+        &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+        &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+        &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+        &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+        &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+        &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+        &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+        &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+        &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+        &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+        &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+        &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+        &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+        &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+        &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+        &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+        &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+        &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+        &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+        &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+        &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+        &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_invalid, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+        &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_invalid, &&op_0xDC, &&op_invalid, &&op_0xDE, &&op_0xDF,
+        &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_invalid, &&op_invalid, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+        &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_invalid, &&op_invalid, &&op_invalid, &&op_0xEE, &&op_0xEF,
+        &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_invalid, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+        &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_invalid, &&op_invalid, &&op_0xFE, &&op_0xFF
+        /* *INDENT-ON* */
+    };
+#endif
 
+next_instruction:
     /* Handle interrupts */
     if ((gb->gb_ime || gb->gb_halt) &&
         (gb->gb_reg.IF & gb->gb_reg.IE & ANY_INTR)) {
@@ -1632,1998 +3356,1879 @@ void __gb_step_cpu(struct gb_s* gb) {
             gb->gb_ime = 0;
 
             /* Push Program Counter */
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
+            WRITE(--sp, pc >> 8);
+            WRITE(--sp, pc & 0xFF);
 
             /* Call interrupt handler if required. */
             if (gb->gb_reg.IF & gb->gb_reg.IE & VBLANK_INTR) {
-                gb->cpu_reg.pc = VBLANK_INTR_ADDR;
+                pc = VBLANK_INTR_ADDR;
                 gb->gb_reg.IF ^= VBLANK_INTR;
             }
             else if (gb->gb_reg.IF & gb->gb_reg.IE & LCDC_INTR) {
-                gb->cpu_reg.pc = LCDC_INTR_ADDR;
+                pc = LCDC_INTR_ADDR;
                 gb->gb_reg.IF ^= LCDC_INTR;
             }
             else if (gb->gb_reg.IF & gb->gb_reg.IE & TIMER_INTR) {
-                gb->cpu_reg.pc = TIMER_INTR_ADDR;
+                pc = TIMER_INTR_ADDR;
                 gb->gb_reg.IF ^= TIMER_INTR;
             }
             else if (gb->gb_reg.IF & gb->gb_reg.IE & SERIAL_INTR) {
-                gb->cpu_reg.pc = SERIAL_INTR_ADDR;
+                pc = SERIAL_INTR_ADDR;
                 gb->gb_reg.IF ^= SERIAL_INTR;
             }
             else if (gb->gb_reg.IF & gb->gb_reg.IE & CONTROL_INTR) {
-                gb->cpu_reg.pc = CONTROL_INTR_ADDR;
+                pc = CONTROL_INTR_ADDR;
                 gb->gb_reg.IF ^= CONTROL_INTR;
             }
         }
     }
 
+    /* While halted, nothing can wake the CPU before the next peripheral
+     * event, so idle up to it at once instead of one NOP at a time. The
+     * cycles are still counted in whole NOPs of 4 cycles each. */
+    if (gb->gb_halt) {
+        uint_fast16_t idle = next_event > pending ? next_event - pending : 0;
+        inst_cycles = idle > 4 ? (idle + 3) & ~(uint_fast16_t)3 : 4;
+        goto end_instruction;
+    }
+
+#if ENABLE_BLOCK_CACHE
+next_block:
+    /* Run code in ROM from its block. */
+    if (pc < VRAM_ADDR && (block = __gb_find_block(gb, pc, op_labels, op_cycles)) != NULL) {
+        op = block->ops;
+        op_end = op + block->count;
+        instructions += block->count;
+        FETCH_UPDATE();
+        /* The first opcode, as the block's ops do not keep their own. */
+        opcode = IMM8();
+        inst_cycles = op->cycles;
+        goto *(op++)->label;
+    }
+
+    instructions++;
+#endif
+
     /* Obtain opcode */
-    opcode = (gb->gb_halt ? 0x00 : __gb_read(gb, gb->cpu_reg.pc++));
+    FETCH_UPDATE();
+    opcode = IMM8();
     inst_cycles = op_cycles[opcode];
 
     /* Execute opcode */
-    switch (opcode) {
-    case 0x00: /* NOP */
-        break;
+    OP_DISPATCH(opcode) {
+    OP(0x00): /* NOP */
+        OP_NEXT;
 
-    case 0x01: /* LD BC, imm */
-        gb->cpu_reg.c = __gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.b = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x01): /* LD BC, imm */
+        gb->cpu_reg.bc = IMM16();
+        OP_NEXT;
 
-    case 0x02: /* LD (BC), A */
-        __gb_write(gb, gb->cpu_reg.bc, gb->cpu_reg.a);
-        break;
+    OP(0x02): /* LD (BC), A */
+        WRITE(gb->cpu_reg.bc, gb->cpu_reg.a);
+        OP_NEXT;
 
-    case 0x03: /* INC BC */
+    OP(0x03): /* INC BC */
         gb->cpu_reg.bc++;
-        break;
+        OP_NEXT;
 
-    case 0x04: /* INC B */
+    OP(0x04): /* INC B */
         gb->cpu_reg.b++;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.b == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.b & 0x0F) == 0x00);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.b);
+        SET_FLAG_N(0);
+        SET_FLAG_H((gb->cpu_reg.b & 0x0F) == 0x00);
+        OP_NEXT;
 
-    case 0x05: /* DEC B */
+    OP(0x05): /* DEC B */
         gb->cpu_reg.b--;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.b == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.b & 0x0F) == 0x0F);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.b);
+        SET_FLAG_N(1);
+        SET_FLAG_H((gb->cpu_reg.b & 0x0F) == 0x0F);
+        OP_NEXT_PAIR(0x20);
 
-    case 0x06: /* LD B, imm */
-        gb->cpu_reg.b = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x06): /* LD B, imm */
+        gb->cpu_reg.b = IMM8();
+        OP_NEXT;
 
-    case 0x07: /* RLCA */
+    OP(0x07): /* RLCA */
         gb->cpu_reg.a = (gb->cpu_reg.a << 1) | (gb->cpu_reg.a >> 7);
-        gb->cpu_reg.f_bits.z = 0;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = (gb->cpu_reg.a & 0x01);
-        break;
+        SET_FLAG_Z(0);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(gb->cpu_reg.a & 0x01);
+        OP_NEXT;
 
-    case 0x08: /* LD (imm), SP */
+    OP(0x08): /* LD (imm), SP */
     {
-        uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-        temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-        __gb_write(gb, temp++, gb->cpu_reg.sp & 0xFF);
-        __gb_write(gb, temp, gb->cpu_reg.sp >> 8);
-        break;
+        uint16_t temp = IMM16();
+        WRITE(temp++, sp & 0xFF);
+        WRITE(temp, sp >> 8);
+        OP_NEXT;
     }
 
-    case 0x09: /* ADD HL, BC */
+    OP(0x09): /* ADD HL, BC */
     {
         uint_fast32_t temp = gb->cpu_reg.hl + gb->cpu_reg.bc;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (temp ^ gb->cpu_reg.hl ^ gb->cpu_reg.bc) & 0x1000 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFFFF0000) ? 1 : 0;
+        SET_FLAG_N(0);
+        SET_FLAG_H((temp ^ gb->cpu_reg.hl ^ gb->cpu_reg.bc) & 0x1000 ? 1 : 0);
+        SET_FLAG_C((temp & 0xFFFF0000) ? 1 : 0);
         gb->cpu_reg.hl = (temp & 0x0000FFFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x0A: /* LD A, (BC) */
-        gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.bc);
-        break;
+    OP(0x0A): /* LD A, (BC) */
+        gb->cpu_reg.a = READ(gb->cpu_reg.bc);
+        OP_NEXT;
 
-    case 0x0B: /* DEC BC */
+    OP(0x0B): /* DEC BC */
         gb->cpu_reg.bc--;
-        break;
+        OP_NEXT;
 
-    case 0x0C: /* INC C */
+    OP(0x0C): /* INC C */
         gb->cpu_reg.c++;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.c == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.c & 0x0F) == 0x00);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.c);
+        SET_FLAG_N(0);
+        SET_FLAG_H((gb->cpu_reg.c & 0x0F) == 0x00);
+        OP_NEXT;
 
-    case 0x0D: /* DEC C */
+    OP(0x0D): /* DEC C */
         gb->cpu_reg.c--;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.c == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.c & 0x0F) == 0x0F);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.c);
+        SET_FLAG_N(1);
+        SET_FLAG_H((gb->cpu_reg.c & 0x0F) == 0x0F);
+        OP_NEXT_PAIR(0x20);
 
-    case 0x0E: /* LD C, imm */
-        gb->cpu_reg.c = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x0E): /* LD C, imm */
+        gb->cpu_reg.c = IMM8();
+        OP_NEXT;
 
-    case 0x0F: /* RRCA */
-        gb->cpu_reg.f_bits.c = gb->cpu_reg.a & 0x01;
+    OP(0x0F): /* RRCA */
+        SET_FLAG_C(gb->cpu_reg.a & 0x01);
         gb->cpu_reg.a = (gb->cpu_reg.a >> 1) | (gb->cpu_reg.a << 7);
-        gb->cpu_reg.f_bits.z = 0;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        break;
+        SET_FLAG_Z(0);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        OP_NEXT;
 
-    case 0x10: /* STOP */
+    OP(0x10): /* STOP */
         //gb->gb_halt = 1;
         if (gb->cgb.cgbMode & gb->cgb.doubleSpeedPrep) {
+            /* Cycles run so far were at the previous speed. */
+            CPU_SAVE();
+            __gb_sync(gb);
+            CPU_LOAD();
+            next_event = 0;
             gb->cgb.doubleSpeedPrep = 0;
             gb->cgb.doubleSpeed ^= 1;
         }
-        break;
+        OP_NEXT;
 
-    case 0x11: /* LD DE, imm */
-        gb->cpu_reg.e = __gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.d = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x11): /* LD DE, imm */
+        gb->cpu_reg.de = IMM16();
+        OP_NEXT;
 
-    case 0x12: /* LD (DE), A */
-        __gb_write(gb, gb->cpu_reg.de, gb->cpu_reg.a);
-        break;
+    OP(0x12): /* LD (DE), A */
+        WRITE(gb->cpu_reg.de, gb->cpu_reg.a);
+        OP_NEXT;
 
-    case 0x13: /* INC DE */
+    OP(0x13): /* INC DE */
         gb->cpu_reg.de++;
-        break;
+        OP_NEXT;
 
-    case 0x14: /* INC D */
+    OP(0x14): /* INC D */
         gb->cpu_reg.d++;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.d == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.d & 0x0F) == 0x00);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.d);
+        SET_FLAG_N(0);
+        SET_FLAG_H((gb->cpu_reg.d & 0x0F) == 0x00);
+        OP_NEXT;
 
-    case 0x15: /* DEC D */
+    OP(0x15): /* DEC D */
         gb->cpu_reg.d--;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.d == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.d & 0x0F) == 0x0F);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.d);
+        SET_FLAG_N(1);
+        SET_FLAG_H((gb->cpu_reg.d & 0x0F) == 0x0F);
+        OP_NEXT;
 
-    case 0x16: /* LD D, imm */
-        gb->cpu_reg.d = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x16): /* LD D, imm */
+        gb->cpu_reg.d = IMM8();
+        OP_NEXT;
 
-    case 0x17: /* RLA */
+    OP(0x17): /* RLA */
     {
         uint8_t temp = gb->cpu_reg.a;
-        gb->cpu_reg.a = (gb->cpu_reg.a << 1) | gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = 0;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = (temp >> 7) & 0x01;
-        break;
+        gb->cpu_reg.a = (gb->cpu_reg.a << 1) | FLAG_C;
+        SET_FLAG_Z(0);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C((temp >> 7) & 0x01);
+        OP_NEXT;
     }
 
-    case 0x18: /* JR imm */
+    OP(0x18): /* JR imm */
     {
-        int8_t temp = (int8_t)__gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.pc += temp;
-        break;
+        int8_t temp = (int8_t)IMM8();
+        pc += temp;
+        CPU_SAVE();
+        inst_cycles += __gb_idle_loop(gb, pc - temp, inst_cycles);
+        OP_NEXT_PAIR(0x18);
     }
 
-    case 0x19: /* ADD HL, DE */
+    OP(0x19): /* ADD HL, DE */
     {
         uint_fast32_t temp = gb->cpu_reg.hl + gb->cpu_reg.de;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (temp ^ gb->cpu_reg.hl ^ gb->cpu_reg.de) & 0x1000 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFFFF0000) ? 1 : 0;
+        SET_FLAG_N(0);
+        SET_FLAG_H((temp ^ gb->cpu_reg.hl ^ gb->cpu_reg.de) & 0x1000 ? 1 : 0);
+        SET_FLAG_C((temp & 0xFFFF0000) ? 1 : 0);
         gb->cpu_reg.hl = (temp & 0x0000FFFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x1A: /* LD A, (DE) */
-        gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.de);
-        break;
+    OP(0x1A): /* LD A, (DE) */
+        gb->cpu_reg.a = READ(gb->cpu_reg.de);
+        OP_NEXT;
 
-    case 0x1B: /* DEC DE */
+    OP(0x1B): /* DEC DE */
         gb->cpu_reg.de--;
-        break;
+        OP_NEXT;
 
-    case 0x1C: /* INC E */
+    OP(0x1C): /* INC E */
         gb->cpu_reg.e++;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.e == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.e & 0x0F) == 0x00);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.e);
+        SET_FLAG_N(0);
+        SET_FLAG_H((gb->cpu_reg.e & 0x0F) == 0x00);
+        OP_NEXT;
 
-    case 0x1D: /* DEC E */
+    OP(0x1D): /* DEC E */
         gb->cpu_reg.e--;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.e == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.e & 0x0F) == 0x0F);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.e);
+        SET_FLAG_N(1);
+        SET_FLAG_H((gb->cpu_reg.e & 0x0F) == 0x0F);
+        OP_NEXT;
 
-    case 0x1E: /* LD E, imm */
-        gb->cpu_reg.e = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x1E): /* LD E, imm */
+        gb->cpu_reg.e = IMM8();
+        OP_NEXT;
 
-    case 0x1F: /* RRA */
+    OP(0x1F): /* RRA */
     {
         uint8_t temp = gb->cpu_reg.a;
-        gb->cpu_reg.a = gb->cpu_reg.a >> 1 | (gb->cpu_reg.f_bits.c << 7);
-        gb->cpu_reg.f_bits.z = 0;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = temp & 0x1;
-        break;
+        gb->cpu_reg.a = gb->cpu_reg.a >> 1 | (FLAG_C << 7);
+        SET_FLAG_Z(0);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(temp & 0x1);
+        OP_NEXT;
     }
 
-    case 0x20: /* JP NZ, imm */
-        if (!gb->cpu_reg.f_bits.z) {
-            int8_t temp = (int8_t)__gb_read(gb, gb->cpu_reg.pc++);
-            gb->cpu_reg.pc += temp;
+    OP(0x20): /* JP NZ, imm */
+        if (!FLAG_Z) {
+            int8_t temp = (int8_t)IMM8();
+            pc += temp;
             inst_cycles += 4;
+            CPU_SAVE();
+            inst_cycles += __gb_idle_loop(gb, pc - temp, inst_cycles);
         }
         else
-            gb->cpu_reg.pc++;
+            pc++;
 
-        break;
+        OP_NEXT;
 
-    case 0x21: /* LD HL, imm */
-        gb->cpu_reg.l = __gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.h = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x21): /* LD HL, imm */
+        gb->cpu_reg.hl = IMM16();
+        OP_NEXT_PAIR(0x7E);
 
-    case 0x22: /* LDI (HL), A */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.a);
+    OP(0x22): /* LDI (HL), A */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.a);
         gb->cpu_reg.hl++;
-        break;
+        OP_NEXT;
 
-    case 0x23: /* INC HL */
+    OP(0x23): /* INC HL */
         gb->cpu_reg.hl++;
-        break;
+        OP_NEXT_PAIR(0x7E);
 
-    case 0x24: /* INC H */
+    OP(0x24): /* INC H */
         gb->cpu_reg.h++;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.h == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.h & 0x0F) == 0x00);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.h);
+        SET_FLAG_N(0);
+        SET_FLAG_H((gb->cpu_reg.h & 0x0F) == 0x00);
+        OP_NEXT;
 
-    case 0x25: /* DEC H */
+    OP(0x25): /* DEC H */
         gb->cpu_reg.h--;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.h == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.h & 0x0F) == 0x0F);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.h);
+        SET_FLAG_N(1);
+        SET_FLAG_H((gb->cpu_reg.h & 0x0F) == 0x0F);
+        OP_NEXT;
 
-    case 0x26: /* LD H, imm */
-        gb->cpu_reg.h = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x26): /* LD H, imm */
+        gb->cpu_reg.h = IMM8();
+        OP_NEXT;
 
-    case 0x27: /* DAA */
+    OP(0x27): /* DAA */
     {
         uint16_t a = gb->cpu_reg.a;
 
-        if (gb->cpu_reg.f_bits.n) {
-            if (gb->cpu_reg.f_bits.h)
+        if (FLAG_N) {
+            if (FLAG_H)
                 a = (a - 0x06) & 0xFF;
 
-            if (gb->cpu_reg.f_bits.c)
+            if (FLAG_C)
                 a -= 0x60;
         }
         else {
-            if (gb->cpu_reg.f_bits.h || (a & 0x0F) > 9)
+            if (FLAG_H || (a & 0x0F) > 9)
                 a += 0x06;
 
-            if (gb->cpu_reg.f_bits.c || a > 0x9F)
+            if (FLAG_C || a > 0x9F)
                 a += 0x60;
         }
 
         if ((a & 0x100) == 0x100)
-            gb->cpu_reg.f_bits.c = 1;
+            SET_FLAG_C(1);
 
         gb->cpu_reg.a = a;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0);
-        gb->cpu_reg.f_bits.h = 0;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_H(0);
 
-        break;
+        OP_NEXT;
     }
 
-    case 0x28: /* JP Z, imm */
-        if (gb->cpu_reg.f_bits.z) {
-            int8_t temp = (int8_t)__gb_read(gb, gb->cpu_reg.pc++);
-            gb->cpu_reg.pc += temp;
+    OP(0x28): /* JP Z, imm */
+        if (FLAG_Z) {
+            int8_t temp = (int8_t)IMM8();
+            pc += temp;
             inst_cycles += 4;
+            CPU_SAVE();
+            inst_cycles += __gb_idle_loop(gb, pc - temp, inst_cycles);
         }
         else
-            gb->cpu_reg.pc++;
+            pc++;
 
-        break;
+        OP_NEXT;
 
-    case 0x29: /* ADD HL, HL */
+    OP(0x29): /* ADD HL, HL */
     {
         uint_fast32_t temp = gb->cpu_reg.hl + gb->cpu_reg.hl;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = (temp & 0x1000) ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFFFF0000) ? 1 : 0;
+        SET_FLAG_N(0);
+        SET_FLAG_H((temp & 0x1000) ? 1 : 0);
+        SET_FLAG_C((temp & 0xFFFF0000) ? 1 : 0);
         gb->cpu_reg.hl = (temp & 0x0000FFFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x2A: /* LD A, (HL+) */
-        gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl++);
-        break;
+    OP(0x2A): /* LD A, (HL+) */
+        gb->cpu_reg.a = READ(gb->cpu_reg.hl++);
+        OP_NEXT_PAIR(0x12);
 
-    case 0x2B: /* DEC HL */
+    OP(0x2B): /* DEC HL */
         gb->cpu_reg.hl--;
-        break;
+        OP_NEXT;
 
-    case 0x2C: /* INC L */
+    OP(0x2C): /* INC L */
         gb->cpu_reg.l++;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.l == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.l & 0x0F) == 0x00);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.l);
+        SET_FLAG_N(0);
+        SET_FLAG_H((gb->cpu_reg.l & 0x0F) == 0x00);
+        OP_NEXT;
 
-    case 0x2D: /* DEC L */
+    OP(0x2D): /* DEC L */
         gb->cpu_reg.l--;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.l == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.l & 0x0F) == 0x0F);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.l);
+        SET_FLAG_N(1);
+        SET_FLAG_H((gb->cpu_reg.l & 0x0F) == 0x0F);
+        OP_NEXT;
 
-    case 0x2E: /* LD L, imm */
-        gb->cpu_reg.l = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x2E): /* LD L, imm */
+        gb->cpu_reg.l = IMM8();
+        OP_NEXT;
 
-    case 0x2F: /* CPL */
+    OP(0x2F): /* CPL */
         gb->cpu_reg.a = ~gb->cpu_reg.a;
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = 1;
-        break;
-
-    case 0x30: /* JP NC, imm */
-        if (!gb->cpu_reg.f_bits.c) {
-            int8_t temp = (int8_t)__gb_read(gb, gb->cpu_reg.pc++);
-            gb->cpu_reg.pc += temp;
+        SET_FLAG_N(1);
+        SET_FLAG_H(1);
+        OP_NEXT;
+
+    OP(0x30): /* JP NC, imm */
+        if (!FLAG_C) {
+            int8_t temp = (int8_t)IMM8();
+            pc += temp;
             inst_cycles += 4;
+            CPU_SAVE();
+            inst_cycles += __gb_idle_loop(gb, pc - temp, inst_cycles);
         }
         else
-            gb->cpu_reg.pc++;
+            pc++;
 
-        break;
+        OP_NEXT;
 
-    case 0x31: /* LD SP, imm */
-        gb->cpu_reg.sp = __gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.sp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-        break;
+    OP(0x31): /* LD SP, imm */
+        sp = IMM16();
+        OP_NEXT;
 
-    case 0x32: /* LD (HL), A */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.a);
+    OP(0x32): /* LD (HL), A */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.a);
         gb->cpu_reg.hl--;
-        break;
+        OP_NEXT;
 
-    case 0x33: /* INC SP */
-        gb->cpu_reg.sp++;
-        break;
+    OP(0x33): /* INC SP */
+        sp++;
+        OP_NEXT;
 
-    case 0x34: /* INC (HL) */
+    OP(0x34): /* INC (HL) */
     {
-        uint8_t temp = __gb_read(gb, gb->cpu_reg.hl) + 1;
-        gb->cpu_reg.f_bits.z = (temp == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((temp & 0x0F) == 0x00);
-        __gb_write(gb, gb->cpu_reg.hl, temp);
-        break;
+        uint8_t temp = READ(gb->cpu_reg.hl) + 1;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_FLAG_H((temp & 0x0F) == 0x00);
+        WRITE(gb->cpu_reg.hl, temp);
+        OP_NEXT;
     }
 
-    case 0x35: /* DEC (HL) */
+    OP(0x35): /* DEC (HL) */
     {
-        uint8_t temp = __gb_read(gb, gb->cpu_reg.hl) - 1;
-        gb->cpu_reg.f_bits.z = (temp == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((temp & 0x0F) == 0x0F);
-        __gb_write(gb, gb->cpu_reg.hl, temp);
-        break;
+        uint8_t temp = READ(gb->cpu_reg.hl) - 1;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_FLAG_H((temp & 0x0F) == 0x0F);
+        WRITE(gb->cpu_reg.hl, temp);
+        OP_NEXT;
     }
 
-    case 0x36: /* LD (HL), imm */
-        __gb_write(gb, gb->cpu_reg.hl, __gb_read(gb, gb->cpu_reg.pc++));
-        break;
+    OP(0x36): /* LD (HL), imm */
+        WRITE(gb->cpu_reg.hl, IMM8());
+        OP_NEXT;
 
-    case 0x37: /* SCF */
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 1;
-        break;
+    OP(0x37): /* SCF */
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(1);
+        OP_NEXT;
 
-    case 0x38: /* JP C, imm */
-        if (gb->cpu_reg.f_bits.c) {
-            int8_t temp = (int8_t)__gb_read(gb, gb->cpu_reg.pc++);
-            gb->cpu_reg.pc += temp;
+    OP(0x38): /* JP C, imm */
+        if (FLAG_C) {
+            int8_t temp = (int8_t)IMM8();
+            pc += temp;
             inst_cycles += 4;
+            CPU_SAVE();
+            inst_cycles += __gb_idle_loop(gb, pc - temp, inst_cycles);
         }
         else
-            gb->cpu_reg.pc++;
+            pc++;
 
-        break;
+        OP_NEXT;
 
-    case 0x39: /* ADD HL, SP */
+    OP(0x39): /* ADD HL, SP */
     {
-        uint_fast32_t temp = gb->cpu_reg.hl + gb->cpu_reg.sp;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            ((gb->cpu_reg.hl & 0xFFF) + (gb->cpu_reg.sp & 0xFFF)) & 0x1000 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = temp & 0x10000 ? 1 : 0;
+        uint_fast32_t temp = gb->cpu_reg.hl + sp;
+        SET_FLAG_N(0);
+        SET_FLAG_H(
+            ((gb->cpu_reg.hl & 0xFFF) + (sp & 0xFFF)) & 0x1000 ? 1 : 0);
+        SET_FLAG_C(temp & 0x10000 ? 1 : 0);
         gb->cpu_reg.hl = (uint16_t)temp;
-        break;
+        OP_NEXT;
     }
 
-    case 0x3A: /* LD A, (HL--) */
-        gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl--);
-        break;
+    OP(0x3A): /* LD A, (HL--) */
+        gb->cpu_reg.a = READ(gb->cpu_reg.hl--);
+        OP_NEXT;
 
-    case 0x3B: /* DEC SP */
-        gb->cpu_reg.sp--;
-        break;
+    OP(0x3B): /* DEC SP */
+        sp--;
+        OP_NEXT;
 
-    case 0x3C: /* INC A */
+    OP(0x3C): /* INC A */
         gb->cpu_reg.a++;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.a & 0x0F) == 0x00);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H((gb->cpu_reg.a & 0x0F) == 0x00);
+        OP_NEXT;
 
-    case 0x3D: /* DEC A */
+    OP(0x3D): /* DEC A */
         gb->cpu_reg.a--;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.a & 0x0F) == 0x0F);
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(1);
+        SET_FLAG_H((gb->cpu_reg.a & 0x0F) == 0x0F);
+        OP_NEXT_PAIR(0x20);
 
-    case 0x3E: /* LD A, imm */
-        gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.pc++);
-        break;
+    OP(0x3E): /* LD A, imm */
+        gb->cpu_reg.a = IMM8();
+        OP_NEXT;
 
-    case 0x3F: /* CCF */
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = ~gb->cpu_reg.f_bits.c;
-        break;
+    OP(0x3F): /* CCF */
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(!FLAG_C);
+        OP_NEXT;
 
-    case 0x40: /* LD B, B */
-        break;
+    OP(0x40): /* LD B, B */
+        OP_NEXT;
 
-    case 0x41: /* LD B, C */
+    OP(0x41): /* LD B, C */
         gb->cpu_reg.b = gb->cpu_reg.c;
-        break;
+        OP_NEXT;
 
-    case 0x42: /* LD B, D */
+    OP(0x42): /* LD B, D */
         gb->cpu_reg.b = gb->cpu_reg.d;
-        break;
+        OP_NEXT;
 
-    case 0x43: /* LD B, E */
+    OP(0x43): /* LD B, E */
         gb->cpu_reg.b = gb->cpu_reg.e;
-        break;
+        OP_NEXT;
 
-    case 0x44: /* LD B, H */
+    OP(0x44): /* LD B, H */
         gb->cpu_reg.b = gb->cpu_reg.h;
-        break;
+        OP_NEXT;
 
-    case 0x45: /* LD B, L */
+    OP(0x45): /* LD B, L */
         gb->cpu_reg.b = gb->cpu_reg.l;
-        break;
+        OP_NEXT;
 
-    case 0x46: /* LD B, (HL) */
-        gb->cpu_reg.b = __gb_read(gb, gb->cpu_reg.hl);
-        break;
+    OP(0x46): /* LD B, (HL) */
+        gb->cpu_reg.b = READ(gb->cpu_reg.hl);
+        OP_NEXT;
 
-    case 0x47: /* LD B, A */
+    OP(0x47): /* LD B, A */
         gb->cpu_reg.b = gb->cpu_reg.a;
-        break;
+        OP_NEXT;
 
-    case 0x48: /* LD C, B */
+    OP(0x48): /* LD C, B */
         gb->cpu_reg.c = gb->cpu_reg.b;
-        break;
+        OP_NEXT;
 
-    case 0x49: /* LD C, C */
-        break;
+    OP(0x49): /* LD C, C */
+        OP_NEXT;
 
-    case 0x4A: /* LD C, D */
+    OP(0x4A): /* LD C, D */
         gb->cpu_reg.c = gb->cpu_reg.d;
-        break;
+        OP_NEXT;
 
-    case 0x4B: /* LD C, E */
+    OP(0x4B): /* LD C, E */
         gb->cpu_reg.c = gb->cpu_reg.e;
-        break;
+        OP_NEXT;
 
-    case 0x4C: /* LD C, H */
+    OP(0x4C): /* LD C, H */
         gb->cpu_reg.c = gb->cpu_reg.h;
-        break;
+        OP_NEXT;
 
-    case 0x4D: /* LD C, L */
+    OP(0x4D): /* LD C, L */
         gb->cpu_reg.c = gb->cpu_reg.l;
-        break;
+        OP_NEXT;
 
-    case 0x4E: /* LD C, (HL) */
-        gb->cpu_reg.c = __gb_read(gb, gb->cpu_reg.hl);
-        break;
+    OP(0x4E): /* LD C, (HL) */
+        gb->cpu_reg.c = READ(gb->cpu_reg.hl);
+        OP_NEXT;
 
-    case 0x4F: /* LD C, A */
+    OP(0x4F): /* LD C, A */
         gb->cpu_reg.c = gb->cpu_reg.a;
-        break;
+        OP_NEXT;
 
-    case 0x50: /* LD D, B */
+    OP(0x50): /* LD D, B */
         gb->cpu_reg.d = gb->cpu_reg.b;
-        break;
+        OP_NEXT;
 
-    case 0x51: /* LD D, C */
+    OP(0x51): /* LD D, C */
         gb->cpu_reg.d = gb->cpu_reg.c;
-        break;
+        OP_NEXT;
 
-    case 0x52: /* LD D, D */
-        break;
+    OP(0x52): /* LD D, D */
+        OP_NEXT;
 
-    case 0x53: /* LD D, E */
+    OP(0x53): /* LD D, E */
         gb->cpu_reg.d = gb->cpu_reg.e;
-        break;
+        OP_NEXT;
 
-    case 0x54: /* LD D, H */
+    OP(0x54): /* LD D, H */
         gb->cpu_reg.d = gb->cpu_reg.h;
-        break;
+        OP_NEXT;
 
-    case 0x55: /* LD D, L */
+    OP(0x55): /* LD D, L */
         gb->cpu_reg.d = gb->cpu_reg.l;
-        break;
+        OP_NEXT;
 
-    case 0x56: /* LD D, (HL) */
-        gb->cpu_reg.d = __gb_read(gb, gb->cpu_reg.hl);
-        break;
+    OP(0x56): /* LD D, (HL) */
+        gb->cpu_reg.d = READ(gb->cpu_reg.hl);
+        OP_NEXT;
 
-    case 0x57: /* LD D, A */
+    OP(0x57): /* LD D, A */
         gb->cpu_reg.d = gb->cpu_reg.a;
-        break;
+        OP_NEXT;
 
-    case 0x58: /* LD E, B */
+    OP(0x58): /* LD E, B */
         gb->cpu_reg.e = gb->cpu_reg.b;
-        break;
+        OP_NEXT;
 
-    case 0x59: /* LD E, C */
+    OP(0x59): /* LD E, C */
         gb->cpu_reg.e = gb->cpu_reg.c;
-        break;
+        OP_NEXT;
 
-    case 0x5A: /* LD E, D */
+    OP(0x5A): /* LD E, D */
         gb->cpu_reg.e = gb->cpu_reg.d;
-        break;
+        OP_NEXT;
 
-    case 0x5B: /* LD E, E */
-        break;
+    OP(0x5B): /* LD E, E */
+        OP_NEXT;
 
-    case 0x5C: /* LD E, H */
+    OP(0x5C): /* LD E, H */
         gb->cpu_reg.e = gb->cpu_reg.h;
-        break;
+        OP_NEXT;
 
-    case 0x5D: /* LD E, L */
+    OP(0x5D): /* LD E, L */
         gb->cpu_reg.e = gb->cpu_reg.l;
-        break;
+        OP_NEXT;
 
-    case 0x5E: /* LD E, (HL) */
-        gb->cpu_reg.e = __gb_read(gb, gb->cpu_reg.hl);
-        break;
+    OP(0x5E): /* LD E, (HL) */
+        gb->cpu_reg.e = READ(gb->cpu_reg.hl);
+        OP_NEXT;
 
-    case 0x5F: /* LD E, A */
+    OP(0x5F): /* LD E, A */
         gb->cpu_reg.e = gb->cpu_reg.a;
-        break;
+        OP_NEXT;
 
-    case 0x60: /* LD H, B */
+    OP(0x60): /* LD H, B */
         gb->cpu_reg.h = gb->cpu_reg.b;
-        break;
+        OP_NEXT;
 
-    case 0x61: /* LD H, C */
+    OP(0x61): /* LD H, C */
         gb->cpu_reg.h = gb->cpu_reg.c;
-        break;
+        OP_NEXT;
 
-    case 0x62: /* LD H, D */
+    OP(0x62): /* LD H, D */
         gb->cpu_reg.h = gb->cpu_reg.d;
-        break;
+        OP_NEXT;
 
-    case 0x63: /* LD H, E */
+    OP(0x63): /* LD H, E */
         gb->cpu_reg.h = gb->cpu_reg.e;
-        break;
+        OP_NEXT;
 
-    case 0x64: /* LD H, H */
-        break;
+    OP(0x64): /* LD H, H */
+        OP_NEXT;
 
-    case 0x65: /* LD H, L */
+    OP(0x65): /* LD H, L */
         gb->cpu_reg.h = gb->cpu_reg.l;
-        break;
+        OP_NEXT;
 
-    case 0x66: /* LD H, (HL) */
-        gb->cpu_reg.h = __gb_read(gb, gb->cpu_reg.hl);
-        break;
+    OP(0x66): /* LD H, (HL) */
+        gb->cpu_reg.h = READ(gb->cpu_reg.hl);
+        OP_NEXT;
 
-    case 0x67: /* LD H, A */
+    OP(0x67): /* LD H, A */
         gb->cpu_reg.h = gb->cpu_reg.a;
-        break;
+        OP_NEXT;
 
-    case 0x68: /* LD L, B */
+    OP(0x68): /* LD L, B */
         gb->cpu_reg.l = gb->cpu_reg.b;
-        break;
+        OP_NEXT;
 
-    case 0x69: /* LD L, C */
+    OP(0x69): /* LD L, C */
         gb->cpu_reg.l = gb->cpu_reg.c;
-        break;
+        OP_NEXT;
 
-    case 0x6A: /* LD L, D */
+    OP(0x6A): /* LD L, D */
         gb->cpu_reg.l = gb->cpu_reg.d;
-        break;
+        OP_NEXT;
 
-    case 0x6B: /* LD L, E */
+    OP(0x6B): /* LD L, E */
         gb->cpu_reg.l = gb->cpu_reg.e;
-        break;
+        OP_NEXT;
 
-    case 0x6C: /* LD L, H */
+    OP(0x6C): /* LD L, H */
         gb->cpu_reg.l = gb->cpu_reg.h;
-        break;
+        OP_NEXT;
 
-    case 0x6D: /* LD L, L */
-        break;
+    OP(0x6D): /* LD L, L */
+        OP_NEXT;
 
-    case 0x6E: /* LD L, (HL) */
-        gb->cpu_reg.l = __gb_read(gb, gb->cpu_reg.hl);
-        break;
+    OP(0x6E): /* LD L, (HL) */
+        gb->cpu_reg.l = READ(gb->cpu_reg.hl);
+        OP_NEXT;
 
-    case 0x6F: /* LD L, A */
+    OP(0x6F): /* LD L, A */
         gb->cpu_reg.l = gb->cpu_reg.a;
-        break;
+        OP_NEXT;
 
-    case 0x70: /* LD (HL), B */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.b);
-        break;
+    OP(0x70): /* LD (HL), B */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.b);
+        OP_NEXT;
 
-    case 0x71: /* LD (HL), C */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.c);
-        break;
+    OP(0x71): /* LD (HL), C */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.c);
+        OP_NEXT;
 
-    case 0x72: /* LD (HL), D */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.d);
-        break;
+    OP(0x72): /* LD (HL), D */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.d);
+        OP_NEXT;
 
-    case 0x73: /* LD (HL), E */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.e);
-        break;
+    OP(0x73): /* LD (HL), E */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.e);
+        OP_NEXT;
 
-    case 0x74: /* LD (HL), H */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.h);
-        break;
+    OP(0x74): /* LD (HL), H */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.h);
+        OP_NEXT;
 
-    case 0x75: /* LD (HL), L */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.l);
-        break;
+    OP(0x75): /* LD (HL), L */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.l);
+        OP_NEXT;
 
-    case 0x76: /* HALT */
+    OP(0x76): /* HALT */
         /* TODO: Emulate HALT bug? */
         gb->gb_halt = 1;
-        break;
+        OP_NEXT_INTR;
 
-    case 0x77: /* LD (HL), A */
-        __gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.a);
-        break;
+    OP(0x77): /* LD (HL), A */
+        WRITE(gb->cpu_reg.hl, gb->cpu_reg.a);
+        OP_NEXT_PAIR(0x23);
 
-    case 0x78: /* LD A, B */
+    OP(0x78): /* LD A, B */
         gb->cpu_reg.a = gb->cpu_reg.b;
-        break;
+        OP_NEXT;
 
-    case 0x79: /* LD A, C */
+    OP(0x79): /* LD A, C */
         gb->cpu_reg.a = gb->cpu_reg.c;
-        break;
+        OP_NEXT;
 
-    case 0x7A: /* LD A, D */
+    OP(0x7A): /* LD A, D */
         gb->cpu_reg.a = gb->cpu_reg.d;
-        break;
+        OP_NEXT;
 
-    case 0x7B: /* LD A, E */
+    OP(0x7B): /* LD A, E */
         gb->cpu_reg.a = gb->cpu_reg.e;
-        break;
+        OP_NEXT;
 
-    case 0x7C: /* LD A, H */
+    OP(0x7C): /* LD A, H */
         gb->cpu_reg.a = gb->cpu_reg.h;
-        break;
+        OP_NEXT;
 
-    case 0x7D: /* LD A, L */
+    OP(0x7D): /* LD A, L */
         gb->cpu_reg.a = gb->cpu_reg.l;
-        break;
+        OP_NEXT;
 
-    case 0x7E: /* LD A, (HL) */
-        gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl);
-        break;
+    OP(0x7E): /* LD A, (HL) */
+        gb->cpu_reg.a = READ(gb->cpu_reg.hl);
+        OP_NEXT_PAIR(0xF8);
 
-    case 0x7F: /* LD A, A */
-        break;
+    OP(0x7F): /* LD A, A */
+        OP_NEXT;
 
-    case 0x80: /* ADD A, B */
+    OP(0x80): /* ADD A, B */
     {
         uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.b;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x81: /* ADD A, C */
+    OP(0x81): /* ADD A, C */
     {
         uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x82: /* ADD A, D */
+    OP(0x82): /* ADD A, D */
     {
         uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.d;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x83: /* ADD A, E */
+    OP(0x83): /* ADD A, E */
     {
         uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.e;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x84: /* ADD A, H */
+    OP(0x84): /* ADD A, H */
     {
         uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.h;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x85: /* ADD A, L */
+    OP(0x85): /* ADD A, L */
     {
         uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.l;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x86: /* ADD A, (HL) */
+    OP(0x86): /* ADD A, (HL) */
     {
-        uint8_t hl = __gb_read(gb, gb->cpu_reg.hl);
+        uint8_t hl = READ(gb->cpu_reg.hl);
         uint16_t temp = gb->cpu_reg.a + hl;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ hl ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ hl ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT_PAIR(0x23);
     }
 
-    case 0x87: /* ADD A, A */
+    OP(0x87): /* ADD A, A */
     {
         uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.a;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = temp & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x88: /* ADC A, B */
+    OP(0x88): /* ADC A, B */
     {
-        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.b + gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.b + FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x89: /* ADC A, C */
+    OP(0x89): /* ADC A, C */
     {
-        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.c + gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.c + FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x8A: /* ADC A, D */
+    OP(0x8A): /* ADC A, D */
     {
-        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.d + gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.d + FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x8B: /* ADC A, E */
+    OP(0x8B): /* ADC A, E */
     {
-        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.e + gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.e + FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x8C: /* ADC A, H */
+    OP(0x8C): /* ADC A, H */
     {
-        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.h + gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.h + FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x8D: /* ADC A, L */
+    OP(0x8D): /* ADC A, L */
     {
-        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.l + gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.l + FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x8E: /* ADC A, (HL) */
+    OP(0x8E): /* ADC A, (HL) */
     {
-        uint8_t val = __gb_read(gb, gb->cpu_reg.hl);
-        uint16_t temp = gb->cpu_reg.a + val + gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint8_t val = READ(gb->cpu_reg.hl);
+        uint16_t temp = gb->cpu_reg.a + val + FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
+        SET_H_CARRY(gb->cpu_reg.a ^ val ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x8F: /* ADC A, A */
+    OP(0x8F): /* ADC A, A */
     {
-        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.a + gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
+        uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.a + FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(0);
         /* TODO: Optimisation here? */
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.a ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.a ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x90: /* SUB B */
+    OP(0x90): /* SUB B */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.b;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x91: /* SUB C */
+    OP(0x91): /* SUB C */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x92: /* SUB D */
+    OP(0x92): /* SUB D */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.d;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x93: /* SUB E */
+    OP(0x93): /* SUB E */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.e;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x94: /* SUB H */
+    OP(0x94): /* SUB H */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.h;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x95: /* SUB L */
+    OP(0x95): /* SUB L */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.l;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x96: /* SUB (HL) */
+    OP(0x96): /* SUB (HL) */
     {
-        uint8_t val = __gb_read(gb, gb->cpu_reg.hl);
+        uint8_t val = READ(gb->cpu_reg.hl);
         uint16_t temp = gb->cpu_reg.a - val;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ val ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x97: /* SUB A */
+    OP(0x97): /* SUB A */
         gb->cpu_reg.a = 0;
-        gb->cpu_reg.f_bits.z = 1;
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_FLAG_Z(1);
+        SET_FLAG_N(1);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0x98: /* SBC A, B */
+    OP(0x98): /* SBC A, B */
     {
-        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.b - gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.b - FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x99: /* SBC A, C */
+    OP(0x99): /* SBC A, C */
     {
-        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.c - gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.c - FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x9A: /* SBC A, D */
+    OP(0x9A): /* SBC A, D */
     {
-        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.d - gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.d - FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x9B: /* SBC A, E */
+    OP(0x9B): /* SBC A, E */
     {
-        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.e - gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.e - FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x9C: /* SBC A, H */
+    OP(0x9C): /* SBC A, H */
     {
-        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.h - gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.h - FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x9D: /* SBC A, L */
+    OP(0x9D): /* SBC A, L */
     {
-        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.l - gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.l - FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x9E: /* SBC A, (HL) */
+    OP(0x9E): /* SBC A, (HL) */
     {
-        uint8_t val = __gb_read(gb, gb->cpu_reg.hl);
-        uint16_t temp = gb->cpu_reg.a - val - gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        uint8_t val = READ(gb->cpu_reg.hl);
+        uint16_t temp = gb->cpu_reg.a - val - FLAG_C;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ val ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0x9F: /* SBC A, A */
-        gb->cpu_reg.a = gb->cpu_reg.f_bits.c ? 0xFF : 0x00;
-        gb->cpu_reg.f_bits.z = gb->cpu_reg.f_bits.c ? 0x00 : 0x01;
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = gb->cpu_reg.f_bits.c;
-        break;
+    OP(0x9F): /* SBC A, A */
+        gb->cpu_reg.a = FLAG_C ? 0xFF : 0x00;
+        SET_FLAG_Z(FLAG_C ? 0x00 : 0x01);
+        SET_FLAG_N(1);
+        SET_FLAG_H(FLAG_C);
+        OP_NEXT;
 
-    case 0xA0: /* AND B */
+    OP(0xA0): /* AND B */
         gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.b;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xA1: /* AND C */
+    OP(0xA1): /* AND C */
         gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.c;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xA2: /* AND D */
+    OP(0xA2): /* AND D */
         gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.d;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xA3: /* AND E */
+    OP(0xA3): /* AND E */
         gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.e;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xA4: /* AND H */
+    OP(0xA4): /* AND H */
         gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.h;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xA5: /* AND L */
+    OP(0xA5): /* AND L */
         gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.l;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xA6: /* AND (HL) */
-        gb->cpu_reg.a = gb->cpu_reg.a & __gb_read(gb, gb->cpu_reg.hl);
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xA7: /* AND A */
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xA8: /* XOR B */
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xA6): /* AND (HL) */
+        gb->cpu_reg.a = gb->cpu_reg.a & READ(gb->cpu_reg.hl);
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xA7): /* AND A */
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xA8): /* XOR B */
         gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.b;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xA9: /* XOR C */
+    OP(0xA9): /* XOR C */
         gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.c;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xAA: /* XOR D */
+    OP(0xAA): /* XOR D */
         gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.d;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xAB: /* XOR E */
+    OP(0xAB): /* XOR E */
         gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.e;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xAC: /* XOR H */
+    OP(0xAC): /* XOR H */
         gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.h;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xAD: /* XOR L */
+    OP(0xAD): /* XOR L */
         gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.l;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xAE: /* XOR (HL) */
-        gb->cpu_reg.a = gb->cpu_reg.a ^ __gb_read(gb, gb->cpu_reg.hl);
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xAF: /* XOR A */
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xAE): /* XOR (HL) */
+        gb->cpu_reg.a = gb->cpu_reg.a ^ READ(gb->cpu_reg.hl);
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xAF): /* XOR A */
         gb->cpu_reg.a = 0x00;
-        gb->cpu_reg.f_bits.z = 1;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_FLAG_Z(1);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xB0: /* OR B */
+    OP(0xB0): /* OR B */
         gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.b;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xB1: /* OR C */
+    OP(0xB1): /* OR C */
         gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.c;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xB2: /* OR D */
+    OP(0xB2): /* OR D */
         gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.d;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xB3: /* OR E */
+    OP(0xB3): /* OR E */
         gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.e;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xB4: /* OR H */
+    OP(0xB4): /* OR H */
         gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.h;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
 
-    case 0xB5: /* OR L */
+    OP(0xB5): /* OR L */
         gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.l;
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xB6: /* OR (HL) */
-        gb->cpu_reg.a = gb->cpu_reg.a | __gb_read(gb, gb->cpu_reg.hl);
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xB7: /* OR A */
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xB8: /* CP B */
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xB6): /* OR (HL) */
+        gb->cpu_reg.a = gb->cpu_reg.a | READ(gb->cpu_reg.hl);
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xB7): /* OR A */
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xB8): /* CP B */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.b;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-        break;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
+        OP_NEXT;
     }
 
-    case 0xB9: /* CP C */
+    OP(0xB9): /* CP C */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.c;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-        break;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
+        OP_NEXT;
     }
 
-    case 0xBA: /* CP D */
+    OP(0xBA): /* CP D */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.d;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-        break;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
+        OP_NEXT;
     }
 
-    case 0xBB: /* CP E */
+    OP(0xBB): /* CP E */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.e;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-        break;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
+        OP_NEXT;
     }
 
-    case 0xBC: /* CP H */
+    OP(0xBC): /* CP H */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.h;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-        break;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
+        OP_NEXT;
     }
 
-    case 0xBD: /* CP L */
+    OP(0xBD): /* CP L */
     {
         uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.l;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-        break;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
+        OP_NEXT;
     }
 
     /* TODO: Optimsation by combining similar opcode routines. */
-    case 0xBE: /* CP (HL) */
+    OP(0xBE): /* CP (HL) */
     {
-        uint8_t val = __gb_read(gb, gb->cpu_reg.hl);
+        uint8_t val = READ(gb->cpu_reg.hl);
         uint16_t temp = gb->cpu_reg.a - val;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-        break;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ val ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
+        OP_NEXT;
     }
 
-    case 0xBF: /* CP A */
-        gb->cpu_reg.f_bits.z = 1;
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xC0: /* RET NZ */
-        if (!gb->cpu_reg.f_bits.z) {
-            gb->cpu_reg.pc = __gb_read(gb, gb->cpu_reg.sp++);
-            gb->cpu_reg.pc |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
+    OP(0xBF): /* CP A */
+        SET_FLAG_Z(1);
+        SET_FLAG_N(1);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xC0): /* RET NZ */
+        if (!FLAG_Z) {
+            pc = READ(sp++);
+            pc |= READ(sp++) << 8;
             inst_cycles += 12;
         }
 
-        break;
+        OP_NEXT;
 
-    case 0xC1: /* POP BC */
-        gb->cpu_reg.c = __gb_read(gb, gb->cpu_reg.sp++);
-        gb->cpu_reg.b = __gb_read(gb, gb->cpu_reg.sp++);
-        break;
+    OP(0xC1): /* POP BC */
+        gb->cpu_reg.c = READ(sp++);
+        gb->cpu_reg.b = READ(sp++);
+        OP_NEXT;
 
-    case 0xC2: /* JP NZ, imm */
-        if (!gb->cpu_reg.f_bits.z) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-            temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-            gb->cpu_reg.pc = temp;
+    OP(0xC2): /* JP NZ, imm */
+        if (!FLAG_Z) {
+            uint16_t temp = IMM16();
+            const uint16_t end = pc;
+            pc = temp;
             inst_cycles += 4;
+            CPU_SAVE();
+            inst_cycles += __gb_idle_loop(gb, end, inst_cycles);
         }
         else
-            gb->cpu_reg.pc += 2;
+            pc += 2;
 
-        break;
+        OP_NEXT_PAIR(0x18);
 
-    case 0xC3: /* JP imm */
+    OP(0xC3): /* JP imm */
     {
-        uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-        temp |= __gb_read(gb, gb->cpu_reg.pc) << 8;
-        gb->cpu_reg.pc = temp;
-        break;
+        uint16_t temp = IMM8();
+        temp |= READ(pc) << 8;
+        const uint16_t end = pc + 1;
+        pc = temp;
+        CPU_SAVE();
+        inst_cycles += __gb_idle_loop(gb, end, inst_cycles);
+        OP_NEXT;
     }
 
-    case 0xC4: /* CALL NZ imm */
-        if (!gb->cpu_reg.f_bits.z) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-            temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-            gb->cpu_reg.pc = temp;
+    OP(0xC4): /* CALL NZ imm */
+        if (!FLAG_Z) {
+            uint16_t temp = IMM16();
+            WRITE(--sp, pc >> 8);
+            WRITE(--sp, pc & 0xFF);
+            pc = temp;
             inst_cycles += 12;
         }
         else
-            gb->cpu_reg.pc += 2;
+            pc += 2;
 
-        break;
+        OP_NEXT;
 
-    case 0xC5: /* PUSH BC */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.b);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.c);
-        break;
+    OP(0xC5): /* PUSH BC */
+        WRITE(--sp, gb->cpu_reg.b);
+        WRITE(--sp, gb->cpu_reg.c);
+        OP_NEXT;
 
-    case 0xC6: /* ADD A, imm */
+    OP(0xC6): /* ADD A, imm */
     {
         /* Taken from SameBoy, which is released under MIT Licence. */
-        uint8_t value = __gb_read(gb, gb->cpu_reg.pc++);
+        uint8_t value = IMM8();
         uint16_t calc = gb->cpu_reg.a + value;
-        gb->cpu_reg.f_bits.z = ((uint8_t)calc == 0) ? 1 : 0;
-        gb->cpu_reg.f_bits.h =
-            ((gb->cpu_reg.a & 0xF) + (value & 0xF) > 0x0F) ? 1 : 0;
-        gb->cpu_reg.f_bits.c = calc > 0xFF ? 1 : 0;
-        gb->cpu_reg.f_bits.n = 0;
+        SET_Z_RESULT(calc);
+        SET_FLAG_H(((gb->cpu_reg.a & 0xF) + (value & 0xF) > 0x0F) ? 1 : 0);
+        SET_FLAG_C(calc > 0xFF ? 1 : 0);
+        SET_FLAG_N(0);
         gb->cpu_reg.a = (uint8_t)calc;
-        break;
+        OP_NEXT;
     }
 
-    case 0xC7: /* RST 0x0000 */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = 0x0000;
-        break;
-
-    case 0xC8: /* RET Z */
-        if (gb->cpu_reg.f_bits.z) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-            temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-            gb->cpu_reg.pc = temp;
+    OP(0xC7): /* RST 0x0000 */
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = 0x0000;
+        OP_NEXT;
+
+    OP(0xC8): /* RET Z */
+        if (FLAG_Z) {
+            uint16_t temp = READ(sp++);
+            temp |= READ(sp++) << 8;
+            pc = temp;
             inst_cycles += 12;
         }
 
-        break;
+        OP_NEXT;
 
-    case 0xC9: /* RET */
+    OP(0xC9): /* RET */
     {
-        uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-        temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-        gb->cpu_reg.pc = temp;
-        break;
+        uint16_t temp = READ(sp++);
+        temp |= READ(sp++) << 8;
+        pc = temp;
+        OP_NEXT;
     }
 
-    case 0xCA: /* JP Z, imm */
-        if (gb->cpu_reg.f_bits.z) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-            temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-            gb->cpu_reg.pc = temp;
+    OP(0xCA): /* JP Z, imm */
+        if (FLAG_Z) {
+            uint16_t temp = IMM16();
+            const uint16_t end = pc;
+            pc = temp;
             inst_cycles += 4;
+            CPU_SAVE();
+            inst_cycles += __gb_idle_loop(gb, end, inst_cycles);
         }
         else
-            gb->cpu_reg.pc += 2;
+            pc += 2;
 
-        break;
+        OP_NEXT;
 
-    case 0xCB: /* CB INST */
-        inst_cycles = __gb_execute_cb(gb);
-        break;
+    OP(0xCB): /* CB INST */
+    {
+        const uint8_t cbop = IMM8();
+        CPU_SAVE();
+        inst_cycles = __gb_execute_cb(gb, cbop);
+        CPU_LOAD();
+        OP_NEXT;
+    }
 
-    case 0xCC: /* CALL Z, imm */
-        if (gb->cpu_reg.f_bits.z) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-            temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-            gb->cpu_reg.pc = temp;
+    OP(0xCC): /* CALL Z, imm */
+        if (FLAG_Z) {
+            uint16_t temp = IMM16();
+            WRITE(--sp, pc >> 8);
+            WRITE(--sp, pc & 0xFF);
+            pc = temp;
             inst_cycles += 12;
         }
         else
-            gb->cpu_reg.pc += 2;
+            pc += 2;
 
-        break;
+        OP_NEXT;
 
-    case 0xCD: /* CALL imm */
+    OP(0xCD): /* CALL imm */
     {
-        uint16_t addr = __gb_read(gb, gb->cpu_reg.pc++);
-        addr |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = addr;
-    } break;
+        uint16_t addr = IMM16();
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = addr;
+    } OP_NEXT;
 
-    case 0xCE: /* ADC A, imm */
+    OP(0xCE): /* ADC A, imm */
     {
         uint8_t value, a, carry;
-        value = __gb_read(gb, gb->cpu_reg.pc++);
+        value = IMM8();
         a = gb->cpu_reg.a;
-        carry = gb->cpu_reg.f_bits.c;
+        carry = FLAG_C;
         gb->cpu_reg.a = a + value + carry;
 
-        gb->cpu_reg.f_bits.z = gb->cpu_reg.a == 0 ? 1 : 0;
-        gb->cpu_reg.f_bits.h =
-            ((a & 0xF) + (value & 0xF) + carry > 0x0F) ? 1 : 0;
-        gb->cpu_reg.f_bits.c =
-            (((uint16_t)a) + ((uint16_t)value) + carry > 0xFF) ? 1 : 0;
-        gb->cpu_reg.f_bits.n = 0;
-        break;
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_H(((a & 0xF) + (value & 0xF) + carry > 0x0F) ? 1 : 0);
+        SET_FLAG_C((((uint16_t)a) + ((uint16_t)value) + carry > 0xFF) ? 1 : 0);
+        SET_FLAG_N(0);
+        OP_NEXT;
     }
 
-    case 0xCF: /* RST 0x0008 */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = 0x0008;
-        break;
-
-    case 0xD0: /* RET NC */
-        if (!gb->cpu_reg.f_bits.c) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-            temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-            gb->cpu_reg.pc = temp;
+    OP(0xCF): /* RST 0x0008 */
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = 0x0008;
+        OP_NEXT;
+
+    OP(0xD0): /* RET NC */
+        if (!FLAG_C) {
+            uint16_t temp = READ(sp++);
+            temp |= READ(sp++) << 8;
+            pc = temp;
             inst_cycles += 12;
         }
 
-        break;
+        OP_NEXT;
 
-    case 0xD1: /* POP DE */
-        gb->cpu_reg.e = __gb_read(gb, gb->cpu_reg.sp++);
-        gb->cpu_reg.d = __gb_read(gb, gb->cpu_reg.sp++);
-        break;
+    OP(0xD1): /* POP DE */
+        gb->cpu_reg.e = READ(sp++);
+        gb->cpu_reg.d = READ(sp++);
+        OP_NEXT;
 
-    case 0xD2: /* JP NC, imm */
-        if (!gb->cpu_reg.f_bits.c) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-            temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-            gb->cpu_reg.pc = temp;
+    OP(0xD2): /* JP NC, imm */
+        if (!FLAG_C) {
+            uint16_t temp = IMM16();
+            const uint16_t end = pc;
+            pc = temp;
             inst_cycles += 4;
+            CPU_SAVE();
+            inst_cycles += __gb_idle_loop(gb, end, inst_cycles);
         }
         else
-            gb->cpu_reg.pc += 2;
+            pc += 2;
 
-        break;
+        OP_NEXT;
 
-    case 0xD4: /* CALL NC, imm */
-        if (!gb->cpu_reg.f_bits.c) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-            temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-            gb->cpu_reg.pc = temp;
+    OP(0xD4): /* CALL NC, imm */
+        if (!FLAG_C) {
+            uint16_t temp = IMM16();
+            WRITE(--sp, pc >> 8);
+            WRITE(--sp, pc & 0xFF);
+            pc = temp;
             inst_cycles += 12;
         }
         else
-            gb->cpu_reg.pc += 2;
+            pc += 2;
 
-        break;
+        OP_NEXT;
 
-    case 0xD5: /* PUSH DE */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.d);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.e);
-        break;
+    OP(0xD5): /* PUSH DE */
+        WRITE(--sp, gb->cpu_reg.d);
+        WRITE(--sp, gb->cpu_reg.e);
+        OP_NEXT;
 
-    case 0xD6: /* SUB imm */
+    OP(0xD6): /* SUB imm */
     {
-        uint8_t val = __gb_read(gb, gb->cpu_reg.pc++);
+        uint8_t val = IMM8();
         uint16_t temp = gb->cpu_reg.a - val;
-        gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
+        SET_Z_RESULT(temp);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ val ^ temp);
+        SET_FLAG_C((temp & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0xD7: /* RST 0x0010 */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = 0x0010;
-        break;
-
-    case 0xD8: /* RET C */
-        if (gb->cpu_reg.f_bits.c) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-            temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-            gb->cpu_reg.pc = temp;
+    OP(0xD7): /* RST 0x0010 */
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = 0x0010;
+        OP_NEXT;
+
+    OP(0xD8): /* RET C */
+        if (FLAG_C) {
+            uint16_t temp = READ(sp++);
+            temp |= READ(sp++) << 8;
+            pc = temp;
             inst_cycles += 12;
         }
 
-        break;
+        OP_NEXT;
 
-    case 0xD9: /* RETI */
+    OP(0xD9): /* RETI */
     {
-        uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-        temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-        gb->cpu_reg.pc = temp;
+        uint16_t temp = READ(sp++);
+        temp |= READ(sp++) << 8;
+        pc = temp;
         gb->gb_ime = 1;
-    } break;
+    } OP_NEXT_INTR;
 
-    case 0xDA: /* JP C, imm */
-        if (gb->cpu_reg.f_bits.c) {
-            uint16_t addr = __gb_read(gb, gb->cpu_reg.pc++);
-            addr |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-            gb->cpu_reg.pc = addr;
+    OP(0xDA): /* JP C, imm */
+        if (FLAG_C) {
+            uint16_t addr = IMM16();
+            const uint16_t end = pc;
+            pc = addr;
             inst_cycles += 4;
+            CPU_SAVE();
+            inst_cycles += __gb_idle_loop(gb, end, inst_cycles);
         }
         else
-            gb->cpu_reg.pc += 2;
+            pc += 2;
 
-        break;
+        OP_NEXT;
 
-    case 0xDC: /* CALL C, imm */
-        if (gb->cpu_reg.f_bits.c) {
-            uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-            temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-            __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-            gb->cpu_reg.pc = temp;
+    OP(0xDC): /* CALL C, imm */
+        if (FLAG_C) {
+            uint16_t temp = IMM16();
+            WRITE(--sp, pc >> 8);
+            WRITE(--sp, pc & 0xFF);
+            pc = temp;
             inst_cycles += 12;
         }
         else
-            gb->cpu_reg.pc += 2;
+            pc += 2;
 
-        break;
+        OP_NEXT;
 
-    case 0xDE: /* SBC A, imm */
+    OP(0xDE): /* SBC A, imm */
     {
-        uint8_t temp_8 = __gb_read(gb, gb->cpu_reg.pc++);
-        uint16_t temp_16 = gb->cpu_reg.a - temp_8 - gb->cpu_reg.f_bits.c;
-        gb->cpu_reg.f_bits.z = ((temp_16 & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h =
-            (gb->cpu_reg.a ^ temp_8 ^ temp_16) & 0x10 ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp_16 & 0xFF00) ? 1 : 0;
+        uint8_t temp_8 = IMM8();
+        uint16_t temp_16 = gb->cpu_reg.a - temp_8 - FLAG_C;
+        SET_Z_RESULT(temp_16);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ temp_8 ^ temp_16);
+        SET_FLAG_C((temp_16 & 0xFF00) ? 1 : 0);
         gb->cpu_reg.a = (temp_16 & 0xFF);
-        break;
+        OP_NEXT;
     }
 
-    case 0xDF: /* RST 0x0018 */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = 0x0018;
-        break;
+    OP(0xDF): /* RST 0x0018 */
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = 0x0018;
+        OP_NEXT;
 
-    case 0xE0: /* LD (0xFF00+imm), A */
-        __gb_write(gb, 0xFF00 | __gb_read(gb, gb->cpu_reg.pc++),
+    OP(0xE0): /* LD (0xFF00+imm), A */
+        WRITE(0xFF00 | IMM8(),
             gb->cpu_reg.a);
-        break;
+        OP_NEXT;
 
-    case 0xE1: /* POP HL */
-        gb->cpu_reg.l = __gb_read(gb, gb->cpu_reg.sp++);
-        gb->cpu_reg.h = __gb_read(gb, gb->cpu_reg.sp++);
-        break;
+    OP(0xE1): /* POP HL */
+        gb->cpu_reg.l = READ(sp++);
+        gb->cpu_reg.h = READ(sp++);
+        OP_NEXT;
 
-    case 0xE2: /* LD (C), A */
-        __gb_write(gb, 0xFF00 | gb->cpu_reg.c, gb->cpu_reg.a);
-        break;
+    OP(0xE2): /* LD (C), A */
+        WRITE(0xFF00 | gb->cpu_reg.c, gb->cpu_reg.a);
+        OP_NEXT;
 
-    case 0xE5: /* PUSH HL */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.h);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.l);
-        break;
+    OP(0xE5): /* PUSH HL */
+        WRITE(--sp, gb->cpu_reg.h);
+        WRITE(--sp, gb->cpu_reg.l);
+        OP_NEXT;
 
-    case 0xE6: /* AND imm */
+    OP(0xE6): /* AND imm */
         /* TODO: Optimisation? */
-        gb->cpu_reg.a = gb->cpu_reg.a & __gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 1;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xE7: /* RST 0x0020 */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = 0x0020;
-        break;
-
-    case 0xE8: /* ADD SP, imm */
+        gb->cpu_reg.a = gb->cpu_reg.a & IMM8();
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(1);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xE7): /* RST 0x0020 */
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = 0x0020;
+        OP_NEXT;
+
+    OP(0xE8): /* ADD SP, imm */
     {
-        int8_t offset = (int8_t)__gb_read(gb, gb->cpu_reg.pc++);
+        int8_t offset = (int8_t)IMM8();
         /* TODO: Move flag assignments for optimisation. */
-        gb->cpu_reg.f_bits.z = 0;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0;
-        gb->cpu_reg.f_bits.c = ((gb->cpu_reg.sp & 0xFF) + (offset & 0xFF) > 0xFF);
-        gb->cpu_reg.sp += offset;
-        break;
+        SET_FLAG_Z(0);
+        SET_FLAG_N(0);
+        SET_FLAG_H(((sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0);
+        SET_FLAG_C((sp & 0xFF) + (offset & 0xFF) > 0xFF);
+        sp += offset;
+        OP_NEXT;
     }
 
-    case 0xE9: /* JP HL */
-        gb->cpu_reg.pc = gb->cpu_reg.hl;
-        break;
+    OP(0xE9): /* JP HL */
+        pc = gb->cpu_reg.hl;
+        OP_NEXT;
 
-    case 0xEA: /* LD (imm), A */
+    OP(0xEA): /* LD (imm), A */
     {
-        uint16_t addr = __gb_read(gb, gb->cpu_reg.pc++);
-        addr |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-        __gb_write(gb, addr, gb->cpu_reg.a);
-        break;
+        uint16_t addr = IMM16();
+        WRITE(addr, gb->cpu_reg.a);
+        OP_NEXT;
     }
 
-    case 0xEE: /* XOR imm */
-        gb->cpu_reg.a = gb->cpu_reg.a ^ __gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xEF: /* RST 0x0028 */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = 0x0028;
-        break;
-
-    case 0xF0: /* LD A, (0xFF00+imm) */
+    OP(0xEE): /* XOR imm */
+        gb->cpu_reg.a = gb->cpu_reg.a ^ IMM8();
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xEF): /* RST 0x0028 */
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = 0x0028;
+        OP_NEXT;
+
+    OP(0xF0): /* LD A, (0xFF00+imm) */
         gb->cpu_reg.a =
-            __gb_read(gb, 0xFF00 | __gb_read(gb, gb->cpu_reg.pc++));
-        break;
+            READ(0xFF00 | IMM8());
+        OP_NEXT_PAIR(0xE6);
 
-    case 0xF1: /* POP AF */
+    OP(0xF1): /* POP AF */
     {
-        uint8_t temp_8 = __gb_read(gb, gb->cpu_reg.sp++);
-        gb->cpu_reg.f_bits.z = (temp_8 >> 7) & 1;
-        gb->cpu_reg.f_bits.n = (temp_8 >> 6) & 1;
-        gb->cpu_reg.f_bits.h = (temp_8 >> 5) & 1;
-        gb->cpu_reg.f_bits.c = (temp_8 >> 4) & 1;
-        gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.sp++);
-        break;
+        uint8_t temp_8 = READ(sp++);
+        SET_FLAGS(temp_8);
+        gb->cpu_reg.a = READ(sp++);
+        OP_NEXT;
     }
 
-    case 0xF2: /* LD A, (C) */
-        gb->cpu_reg.a = __gb_read(gb, 0xFF00 | gb->cpu_reg.c);
-        break;
+    OP(0xF2): /* LD A, (C) */
+        gb->cpu_reg.a = READ(0xFF00 | gb->cpu_reg.c);
+        OP_NEXT;
 
-    case 0xF3: /* DI */
+    OP(0xF3): /* DI */
         gb->gb_ime = 0;
-        break;
-
-    case 0xF5: /* PUSH AF */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.a);
-        __gb_write(gb, --gb->cpu_reg.sp,
-            gb->cpu_reg.f_bits.z << 7 | gb->cpu_reg.f_bits.n << 6 |
-            gb->cpu_reg.f_bits.h << 5 | gb->cpu_reg.f_bits.c << 4);
-        break;
-
-    case 0xF6: /* OR imm */
-        gb->cpu_reg.a = gb->cpu_reg.a | __gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = 0;
-        gb->cpu_reg.f_bits.c = 0;
-        break;
-
-    case 0xF7: /* RST 0x0030 */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = 0x0030;
-        break;
-
-    case 0xF8: /* LD HL, SP+/-imm */
+        OP_NEXT;
+
+    OP(0xF5): /* PUSH AF */
+        WRITE(--sp, gb->cpu_reg.a);
+        WRITE(--sp, FLAGS);
+        OP_NEXT;
+
+    OP(0xF6): /* OR imm */
+        gb->cpu_reg.a = gb->cpu_reg.a | IMM8();
+        SET_Z_RESULT(gb->cpu_reg.a);
+        SET_FLAG_N(0);
+        SET_FLAG_H(0);
+        SET_FLAG_C(0);
+        OP_NEXT;
+
+    OP(0xF7): /* RST 0x0030 */
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = 0x0030;
+        OP_NEXT;
+
+    OP(0xF8): /* LD HL, SP+/-imm */
     {
         /* Taken from SameBoy, which is released under MIT Licence. */
-        int8_t offset = (int8_t)__gb_read(gb, gb->cpu_reg.pc++);
-        gb->cpu_reg.hl = gb->cpu_reg.sp + offset;
-        gb->cpu_reg.f_bits.z = 0;
-        gb->cpu_reg.f_bits.n = 0;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0;
-        gb->cpu_reg.f_bits.c = ((gb->cpu_reg.sp & 0xFF) + (offset & 0xFF) > 0xFF) ? 1 : 0;
-        break;
+        int8_t offset = (int8_t)IMM8();
+        gb->cpu_reg.hl = sp + offset;
+        SET_FLAG_Z(0);
+        SET_FLAG_N(0);
+        SET_FLAG_H(((sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0);
+        SET_FLAG_C(((sp & 0xFF) + (offset & 0xFF) > 0xFF) ? 1 : 0);
+        OP_NEXT_PAIR(0x77);
     }
 
-    case 0xF9: /* LD SP, HL */
-        gb->cpu_reg.sp = gb->cpu_reg.hl;
-        break;
+    OP(0xF9): /* LD SP, HL */
+        sp = gb->cpu_reg.hl;
+        OP_NEXT;
 
-    case 0xFA: /* LD A, (imm) */
+    OP(0xFA): /* LD A, (imm) */
     {
-        uint16_t addr = __gb_read(gb, gb->cpu_reg.pc++);
-        addr |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-        gb->cpu_reg.a = __gb_read(gb, addr);
-        break;
+        uint16_t addr = IMM16();
+        gb->cpu_reg.a = READ(addr);
+        OP_NEXT;
     }
 
-    case 0xFB: /* EI */
+    OP(0xFB): /* EI */
         gb->gb_ime = 1;
-        break;
+        OP_NEXT_INTR;
 
-    case 0xFE: /* CP imm */
+    OP(0xFE): /* CP imm */
     {
-        uint8_t temp_8 = __gb_read(gb, gb->cpu_reg.pc++);
+        uint8_t temp_8 = IMM8();
         uint16_t temp_16 = gb->cpu_reg.a - temp_8;
-        gb->cpu_reg.f_bits.z = ((temp_16 & 0xFF) == 0x00);
-        gb->cpu_reg.f_bits.n = 1;
-        gb->cpu_reg.f_bits.h = ((gb->cpu_reg.a ^ temp_8 ^ temp_16) & 0x10) ? 1 : 0;
-        gb->cpu_reg.f_bits.c = (temp_16 & 0xFF00) ? 1 : 0;
-        break;
+        SET_Z_RESULT(temp_16);
+        SET_FLAG_N(1);
+        SET_H_CARRY(gb->cpu_reg.a ^ temp_8 ^ temp_16);
+        SET_FLAG_C((temp_16 & 0xFF00) ? 1 : 0);
+        OP_NEXT;
     }
 
-    case 0xFF: /* RST 0x0038 */
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-        __gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-        gb->cpu_reg.pc = 0x0038;
-        break;
+    OP(0xFF): /* RST 0x0038 */
+        WRITE(--sp, pc >> 8);
+        WRITE(--sp, pc & 0xFF);
+        pc = 0x0038;
+        OP_NEXT;
 
-    default:
+    OP_INVALID:
+        CPU_SAVE();
         (gb->gb_error)(gb, GB_INVALID_OPCODE, opcode);
+        CPU_LOAD();
+        OP_NEXT;
     }
 
-    /* DIV register timing */
-    gb->counter.div_count += inst_cycles;
-
-    if (gb->counter.div_count >= DIV_CYCLES) {
-        gb->gb_reg.DIV++;
-        gb->counter.div_count -= DIV_CYCLES;
-    }
-
-    /* Check serial transmission. */
-    if (gb->gb_reg.SC & SERIAL_SC_TX_START) {
-        /* If new transfer, call TX function. */
-        if (gb->counter.serial_count == 0 && gb->gb_serial_tx != NULL)
-            (gb->gb_serial_tx)(gb, gb->gb_reg.SB);
-
-        gb->counter.serial_count += inst_cycles;
-
-        /* If it's time to receive byte, call RX function. */
-        if (gb->counter.serial_count >= SERIAL_CYCLES) {
-            /* If RX can be done, do it. */
-            /* If RX failed, do not change SB if using external
-             * clock, or set to 0xFF if using internal clock. */
-            uint8_t rx;
-
-            if (gb->gb_serial_rx != NULL &&
-                (gb->gb_serial_rx(gb, &rx) ==
-                    GB_SERIAL_RX_SUCCESS)) {
-                gb->gb_reg.SB = rx;
-
-                /* Inform game of serial TX/RX completion. */
-                gb->gb_reg.SC &= 0x01;
-                gb->gb_reg.IF |= SERIAL_INTR;
-            }
-            else if (gb->gb_reg.SC & SERIAL_SC_CLOCK_SRC) {
-                /* If using internal clock, and console is not
-                 * attached to any external peripheral, shifted
-                 * bits are replaced with logic 1. */
-                gb->gb_reg.SB = 0xFF;
-
-                /* Inform game of serial TX/RX completion. */
-                gb->gb_reg.SC &= 0x01;
-                gb->gb_reg.IF |= SERIAL_INTR;
-            }
-            else {
-                /* If using external clock, and console is not
-                 * attached to any external peripheral, bits are
-                 * not shifted, so SB is not modified. */
-            }
-
-            gb->counter.serial_count = 0;
-        }
-    }
-
-    /* TIMA register timing */
-    /* TODO: Change tac_enable to struct of TAC timer control bits. */
-    if (gb->gb_reg.tac_enable) {
-        static const uint_fast16_t TAC_CYCLES[4] = { 1024, 16, 64, 256 };
-
-        gb->counter.tima_count += inst_cycles;
-
-        while (gb->counter.tima_count >= TAC_CYCLES[gb->gb_reg.tac_rate]) {
-            gb->counter.tima_count -= TAC_CYCLES[gb->gb_reg.tac_rate];
-
-            if (++gb->gb_reg.TIMA == 0) {
-                gb->gb_reg.IF |= TIMER_INTR;
-                /* On overflow, set TMA to TIMA. */
-                gb->gb_reg.TIMA = gb->gb_reg.TMA;
-            }
-        }
-    }
-
-    /* TODO Check behaviour of LCD during LCD power off state. */
-    /* If LCD is off, don't update LCD state. */
-    if ((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
-        return;
-
-    /* LCD Timing */
-    gb->counter.lcd_count += (inst_cycles >> gb->cgb.doubleSpeed);
-
-    /* New Scanline */
-    if (gb->counter.lcd_count > LCD_LINE_CYCLES) {
-        gb->counter.lcd_count -= LCD_LINE_CYCLES;
-
-        /* LYC Update */
-        if (gb->gb_reg.LY == gb->gb_reg.LYC) {
-            gb->gb_reg.STAT |= STAT_LYC_COINC;
-
-            if (gb->gb_reg.STAT & STAT_LYC_INTR)
-                gb->gb_reg.IF |= LCDC_INTR;
-        }
-        else
-            gb->gb_reg.STAT &= 0xFB;
-
-        /* Next line */
-        gb->gb_reg.LY = (gb->gb_reg.LY + 1) % LCD_VERT_LINES;
-
-        /* VBLANK Start */
-        if (gb->gb_reg.LY == LCD_HEIGHT) {
-            gb->lcd_mode = LCD_VBLANK;
-            gb->gb_frame = 1;
-            gb->gb_reg.IF |= VBLANK_INTR;
-            gb->lcd_blank = 0;
-
-            if (gb->gb_reg.STAT & STAT_MODE_1_INTR)
-                gb->gb_reg.IF |= LCDC_INTR;
-
-#if ENABLE_LCD
-
-            /* If frame skip is activated, check if we need to draw
-             * the frame or skip it. */
-            if (gb->direct.frame_skip) {
-                gb->display.frame_skip_count =
-                    !gb->display.frame_skip_count;
-            }
-
-            /* If interlaced is activated, change which lines get
-             * updated. Also, only update lines on frames that are
-             * actually drawn when frame skip is enabled. */
-            if (gb->direct.interlace &&
-                (!gb->direct.frame_skip ||
-                    gb->display.frame_skip_count)) {
-                gb->display.interlace_count =
-                    !gb->display.interlace_count;
-            }
-
+end_instruction:
+#if ENABLE_BLOCK_CACHE
+    /* Leave the block, without counting the instructions not run. */
+    instructions -= op_end - op;
+    op_end = op;
 #endif
-        }
-        /* Normal Line */
-        else if (gb->gb_reg.LY < LCD_HEIGHT) {
-            if (gb->gb_reg.LY == 0) {
-                /* Clear Screen */
-                gb->display.WY = gb->gb_reg.WY;
-                gb->display.window_clear = 0;
-            }
-
-            gb->lcd_mode = LCD_HBLANK;
+    pending += inst_cycles;
+    if (pending < next_event)
+        goto next_instruction;
 
-            //DMA GBC
-            if (gb->cgb.cgbMode && (!gb->cgb.dmaActive) && gb->cgb.dmaMode) {
-                for (uint8_t i = 0; i < 0x10; i++) {
-                    __gb_write(gb, ((gb->cgb.dmaDest & 0x1FF0) | 0x8000) + i, __gb_read(gb, (gb->cgb.dmaSource & 0xFFF0) + i));
-                }
-                gb->cgb.dmaSource += 0x10;
-                gb->cgb.dmaDest += 0x10;
-                if (!(--gb->cgb.dmaSize)) gb->cgb.dmaActive = 1;
-            }
-
-            if (gb->gb_reg.STAT & STAT_MODE_0_INTR)
-                gb->gb_reg.IF |= LCDC_INTR;
-        }
-    }
-    /* OAM access */
-    else if (gb->lcd_mode == LCD_HBLANK && gb->counter.lcd_count >= LCD_MODE_2_CYCLES) {
-        gb->lcd_mode = LCD_SEARCH_OAM;
-
-        if (gb->gb_reg.STAT & STAT_MODE_2_INTR)
-            gb->gb_reg.IF |= LCDC_INTR;
-    }
-    /* Update LCD */
-    else if (gb->lcd_mode == LCD_SEARCH_OAM && gb->counter.lcd_count >= LCD_MODE_3_CYCLES) {
-        gb->lcd_mode = LCD_TRANSFER;
-#if ENABLE_LCD
-        if (!gb->lcd_blank)
-            __gb_draw_line(gb);
+    CPU_SAVE();
+#if ENABLE_BLOCK_CACHE
+    gb->block_cache.instructions += instructions;
 #endif
-    }
 }
 
+#undef OP_DISPATCH
+#undef OP
+#undef OP_INVALID
+#undef OP_NEXT
+#undef OP_NEXT_INTR
+#undef OP_NEXT_PAIR
+#undef OP_PROFILE
+#undef CPU_SAVE
+#undef CPU_LOAD
+#undef READ
+#undef WRITE
+#undef IMM8
+#undef IMM16
+#undef FETCH_UPDATE
+
 void gb_run_frame(struct gb_s* gb) {
     gb->gb_frame = 0;
+#if ENABLE_IDLE_LOOP_DETECTION
+    gb->idle.hits = 0;
+    gb->idle.skipped_cycles = 0;
+#endif
+#if ENABLE_BLOCK_CACHE
+    gb->block_cache.hits = 0;
+    gb->block_cache.misses = 0;
+    gb->block_cache.instructions = 0;
+#endif
+
+    while (!gb->gb_frame) {
+        /* Run the CPU alone until the next peripheral event is due. */
+        __gb_run_cpu(gb);
 
-    while (!gb->gb_frame)
-        __gb_step_cpu(gb);
+        __gb_sync(gb);
+#if ENABLE_IDLE_LOOP_DETECTION
+        gb->idle.dirty = 1;
+#endif
+    }
 }
 
 /**
@@ -3652,6 +5257,56 @@ void gb_init_serial(struct gb_s* gb,
     gb->gb_serial_rx = gb_serial_rx;
 }
 
+/**
+ * Let the core read the ROM directly from memory instead of calling
+ * gb_rom_read() for every byte. This is optional, and is only useful to
+ * front-ends that have the whole ROM in memory. gb_rom_read() is still used
+ * for any address outside of the given size.
+ * Must be called after gb_init().
+ *
+ * \param gb        Initialised context.
+ * \param rom        ROM contents, or NULL to only use gb_rom_read().
+ * \param size        Size of the ROM in bytes.
+ */
+void gb_init_rom(struct gb_s* gb, const uint8_t* rom, const uint_fast32_t size) {
+    gb->rom = rom;
+    gb->rom_size = rom != NULL ? size : 0;
+
+    if (rom == NULL) {
+        for (uint_fast8_t i = ROM_0_ADDR >> MEM_PAGE_SHIFT; i < VRAM_ADDR >> MEM_PAGE_SHIFT; i++)
+            gb->mem_map.read[i] = NULL;
+    }
+
+    __gb_update_mem_map(gb);
+#if ENABLE_BLOCK_CACHE
+    __gb_flush_blocks(gb);
+#endif
+}
+
+/**
+ * Let the core access cartridge RAM directly in memory instead of calling
+ * gb_cart_ram_read() and gb_cart_ram_write() for every byte. This is
+ * optional. The MBC3 real time clock registers and any bank outside of the
+ * given size still go through the callbacks.
+ * Must be called after gb_init().
+ *
+ * \param gb        Initialised context.
+ * \param sram        Cartridge RAM of at least gb_get_save_size() bytes, or
+ *             NULL to only use the callbacks.
+ * \param size        Size of the cartridge RAM in bytes.
+ */
+void gb_init_cart_ram(struct gb_s* gb, uint8_t* sram, const uint_fast32_t size) {
+    gb->sram = sram;
+    gb->sram_size = sram != NULL ? size : 0;
+
+    if (sram == NULL) {
+        for (uint_fast8_t i = CART_RAM_ADDR >> MEM_PAGE_SHIFT; i < WRAM_0_ADDR >> MEM_PAGE_SHIFT; i++)
+            gb->mem_map.read[i] = gb->mem_map.write[i] = NULL;
+    }
+
+    __gb_update_mem_map(gb);
+}
+
 uint8_t gb_colour_hash(struct gb_s* gb) {
 #define ROM_TITLE_START_ADDR 0x0134
 #define ROM_TITLE_END_ADDR 0x0143
@@ -3676,12 +5331,14 @@ void gb_reset(struct gb_s* gb) {
     /* Initialise MBC values. */
     gb->selected_rom_bank = 1;
     gb->cart_ram_bank = 0;
+    gb->cart_ram_bank_offset = CART_RAM_ADDR;
     gb->enable_cart_ram = 0;
     gb->cart_mode_select = 0;
 
     /* Initialise CPU registers as though a DMG or CGB. */
     gb->cpu_reg.af = 0x01B0;
     if (gb->cgb.cgbMode) gb->cpu_reg.af = 0x1180;
+    SET_FLAGS(gb->cpu_reg.f);
     gb->cpu_reg.bc = 0x0013;
     if (gb->cgb.cgbMode) gb->cpu_reg.bc = 0x0000;
     gb->cpu_reg.de = 0x00D8;
@@ -3693,15 +5350,36 @@ void gb_reset(struct gb_s* gb) {
     gb->cpu_reg.pc = 0x0100;
 
     gb->counter.lcd_count = 0;
-    gb->counter.div_count = 0;
     gb->counter.tima_count = 0;
     gb->counter.serial_count = 0;
+    gb->counter.total = 0;
+    gb->counter.pending = 0;
+    gb->counter.next_event = 0;
+
+#if ENABLE_IDLE_LOOP_DETECTION
+    gb->idle.hits = 0;
+    gb->idle.skipped_cycles = 0;
+    gb->idle.dirty = 1;
+#endif
+
+#if ENABLE_OP_PROFILE
+    memset(gb->op_profile.pairs, 0, sizeof(gb->op_profile.pairs));
+#endif
+
+#if ENABLE_BLOCK_CACHE
+    __gb_flush_blocks(gb);
+    gb->block_cache.hits = 0;
+    gb->block_cache.misses = 0;
+    gb->block_cache.instructions = 0;
+#endif
 
     gb->gb_reg.TIMA = 0x00;
     gb->gb_reg.TMA = 0x00;
     gb->gb_reg.TAC = 0xF8;
-    gb->gb_reg.DIV = 0xAB;
-    if (gb->cgb.cgbMode) gb->gb_reg.DIV = 0xFF;
+    gb->counter.div_offset = 0xAB;
+    if (gb->cgb.cgbMode) gb->counter.div_offset = 0xFF;
+    gb->counter.tima_time = 0;
+    __gb_update_tima(gb);
 
     gb->gb_reg.IF = 0xE1;
 
@@ -3737,6 +5415,11 @@ void gb_reset(struct gb_s* gb) {
     gb->cgb.dmaSource = 0;
     gb->cgb.dmaDest = 0;
 
+    /* Map the RAM banks selected above. Pages that are not plain memory
+     * stay NULL and go through the MBC and IO handlers. */
+    memset(&gb->mem_map, 0, sizeof(gb->mem_map));
+    __gb_update_mem_map(gb);
+
     __gb_write(gb, 0xFF47, 0xFC);  // BGP
     __gb_write(gb, 0xFF48, 0xFF);  // OBJP0
     __gb_write(gb, 0xFF49, 0x0F);  // OBJP1
@@ -3748,6 +5431,19 @@ void gb_reset(struct gb_s* gb) {
     gb->gb_reg.P1 = 0xCF;
 
     memset(gb->vram, 0x00, VRAM_SIZE);
+#if ENABLE_TILE_CACHE
+    memset(gb->tile_dirty, 1, sizeof(gb->tile_dirty));
+#endif
+#if ENABLE_LCD
+    gb->display.sprites_dirty = 1;
+#endif
+#if ENABLE_LINE_SKIP
+    gb->display.version++;
+#endif
+#if ENABLE_DEFERRED_LINES
+    gb->display.deferred_count = 0;
+    gb->display.deferred_off = 0;
+#endif
 }
 
 /**
@@ -3793,6 +5489,10 @@ enum gb_init_error_e gb_init(struct gb_s* gb,
     const uint8_t num_ram_banks[] = { 0, 1, 1, 4, 16, 8 };
 
     gb->gb_rom_read = gb_rom_read;
+    gb->rom = NULL;
+    gb->rom_size = 0;
+    gb->sram = NULL;
+    gb->sram_size = 0;
     gb->gb_cart_ram_read = gb_cart_ram_read;
     gb->gb_cart_ram_write = gb_cart_ram_write;
     gb->gb_error = gb_error;
@@ -3823,6 +5523,28 @@ enum gb_init_error_e gb_init(struct gb_s* gb,
         if (mbc_value > sizeof(cart_mbc) - 1 ||
             (gb->mbc = cart_mbc[mbc_value]) == 255u)
             return GB_INIT_CARTRIDGE_UNSUPPORTED;
+
+        switch (gb->mbc) {
+        case 1:
+            gb->mbc_write = __gb_write_mbc1;
+            break;
+
+        case 2:
+            gb->mbc_write = __gb_write_mbc2;
+            break;
+
+        case 3:
+            gb->mbc_write = __gb_write_mbc3;
+            break;
+
+        case 5:
+            gb->mbc_write = __gb_write_mbc5;
+            break;
+
+        default:
+            gb->mbc_write = __gb_write_mbc0;
+            break;
+        }
     }
 
     gb->cart_ram = cart_ram[gb->gb_rom_read(gb, mbc_location)];
@@ -3831,6 +5553,10 @@ enum gb_init_error_e gb_init(struct gb_s* gb,
 
     gb->lcd_blank = 0;
     gb->display.lcd_draw_line = NULL;
+    gb->display.lcd_draw_line_rgb565 = NULL;
+#if ENABLE_LCD
+    gb->display.draw_line = gb->cgb.cgbMode ? __gb_draw_line_cgb : __gb_draw_line_dmg;
+#endif
 
     gb_reset(gb);
 
@@ -3866,11 +5592,23 @@ const char* gb_get_rom_name(struct gb_s* gb, char* title_str) {
 }
 
 #if ENABLE_LCD
+/**
+ * Draw every line again, even those that did not change, from the next one
+ * drawn. To be called when the front-end loses what was drawn, such as
+ * after clearing the screen, or changes the way lines are drawn.
+ */
+void gb_refresh_lcd(struct gb_s* gb) {
+#if ENABLE_LINE_SKIP
+    gb->display.version++;
+#endif
+}
+
 void gb_init_lcd(struct gb_s* gb,
     void (*lcd_draw_line)(struct gb_s* gb,
         const uint8_t* pixels,
         const uint_fast8_t line)) {
     gb->display.lcd_draw_line = lcd_draw_line;
+    gb_refresh_lcd(gb);
 
     gb->direct.interlace = 0;
     gb->display.interlace_count = 0;
@@ -3882,4 +5620,36 @@ void gb_init_lcd(struct gb_s* gb,
 
     return;
 }
+
+/**
+ * Initialise LCD output in RGB565 colours instead of palette indexes, the
+ * colours being looked up by the core. This is an alternative to
+ * gb_init_lcd(). For DMG games, colours are set with
+ * gb_set_rgb565_palette().
+ */
+void gb_init_lcd_rgb565(struct gb_s* gb,
+    void (*lcd_draw_line_rgb565)(struct gb_s* gb,
+        const uint16_t* pixels,
+        const uint_fast8_t line)) {
+    gb_init_lcd(gb, NULL);
+    gb->display.lcd_draw_line_rgb565 = lcd_draw_line_rgb565;
+}
+
+/**
+ * Set the RGB565 colours of the four shades of DMG games, used for the
+ * background and both sprite palettes. Ignored for CGB games.
+ */
+void gb_set_rgb565_palette(struct gb_s* gb, const uint16_t* colours) {
+    if (gb->cgb.cgbMode)
+        return;
+
+    for (uint8_t i = 0; i < 4; i++) {
+        if (gb->display.rgb565[i] != colours[i])
+            gb_refresh_lcd(gb);
+
+        gb->display.rgb565[i] = colours[i];
+        gb->display.rgb565[LCD_PALETTE_OBJ | i] = colours[i];
+        gb->display.rgb565[LCD_PALETTE_BG | i] = colours[i];
+    }
+}
 #endif
\ No newline at end of file